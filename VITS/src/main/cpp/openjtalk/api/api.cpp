@@ -110,28 +110,28 @@ int njd_node_get_chain_flag(NJDNode * node){
     return NJDNode_get_chain_flag(node);
 }
 
-Feature* node2feature(NJDNode* node) {
-    Feature* feature = new Feature();
-    feature->string = njd_node_get_string(node);
-    feature->pos = njd_node_get_pos(node);
-    feature->pos_group1 = njd_node_get_pos_group1(node);
-    feature->pos_group2 = njd_node_get_pos_group2(node);
-    feature->pos_group3 = njd_node_get_pos_group3(node);
-    feature->ctype = njd_node_get_ctype(node);
-    feature->cform = njd_node_get_cform(node);
-    feature->orig = njd_node_get_orig(node);
-    feature->read = njd_node_get_read(node);
-    feature->pron = njd_node_get_pron(node);
-    feature->acc = njd_node_get_acc(node);
-    feature->mora_size = njd_node_get_mora_size(node);
-    feature->chain_rule = njd_node_get_chain_rule(node);
-    feature->chain_flag = njd_node_get_chain_flag(node);
+Feature node2feature(NJDNode* node) {
+    Feature feature;
+    feature.string = njd_node_get_string(node);
+    feature.pos = njd_node_get_pos(node);
+    feature.pos_group1 = njd_node_get_pos_group1(node);
+    feature.pos_group2 = njd_node_get_pos_group2(node);
+    feature.pos_group3 = njd_node_get_pos_group3(node);
+    feature.ctype = njd_node_get_ctype(node);
+    feature.cform = njd_node_get_cform(node);
+    feature.orig = njd_node_get_orig(node);
+    feature.read = njd_node_get_read(node);
+    feature.pron = njd_node_get_pron(node);
+    feature.acc = njd_node_get_acc(node);
+    feature.mora_size = njd_node_get_mora_size(node);
+    feature.chain_rule = njd_node_get_chain_rule(node);
+    feature.chain_flag = njd_node_get_chain_flag(node);
     return feature;
 }
 
-vector<Feature*> njd2feature(NJD* njd) {
+vector<Feature> njd2feature(NJD* njd) {
     NJDNode* node = njd->head;
-    vector<Feature*> features;
+    vector<Feature> features;
     while (node) {
         features.push_back(node2feature(node));
         node = node->next;
@@ -139,97 +139,411 @@ vector<Feature*> njd2feature(NJD* njd) {
     return features;
 }
 
-void feature2njd(NJD* njd, const vector<Feature*>& features) {
+void feature2njd(NJD* njd, const vector<Feature>& features) {
     NJDNode* node;
-    for (auto feature : features) {
-        node = new NJDNode();
+    for (const Feature& feature : features) {
+        // NJD_clear releases nodes with free(), as mecab2njd allocates them
+        node = (NJDNode*) calloc(1, sizeof(NJDNode));
         NJDNode_initialize(node);
-        NJDNode_set_string(node, utf8_encode(feature->string).c_str());
-        NJDNode_set_pos(node, utf8_encode(feature->pos).c_str());
-        NJDNode_set_pos_group1(node, utf8_encode(feature->pos_group1).c_str());
-        NJDNode_set_pos_group2(node, utf8_encode(feature->pos_group2).c_str());
-        NJDNode_set_pos_group3(node, utf8_encode(feature->pos_group3).c_str());
-        NJDNode_set_ctype(node, utf8_encode(feature->ctype).c_str());
-        NJDNode_set_cform(node, utf8_encode(feature->cform).c_str());
-        NJDNode_set_orig(node, utf8_encode(feature->orig).c_str());
-        NJDNode_set_read(node, utf8_encode(feature->read).c_str());
-        NJDNode_set_pron(node, utf8_encode(feature->pron).c_str());
-        NJDNode_set_acc(node, feature->acc);
-        NJDNode_set_mora_size(node, feature->mora_size);
-        NJDNode_set_chain_rule(node, utf8_encode(feature->chain_rule).c_str());
-        NJDNode_set_chain_flag(node, feature->chain_flag);
+        NJDNode_set_string(node, utf8_encode(feature.string).c_str());
+        NJDNode_set_pos(node, utf8_encode(feature.pos).c_str());
+        NJDNode_set_pos_group1(node, utf8_encode(feature.pos_group1).c_str());
+        NJDNode_set_pos_group2(node, utf8_encode(feature.pos_group2).c_str());
+        NJDNode_set_pos_group3(node, utf8_encode(feature.pos_group3).c_str());
+        NJDNode_set_ctype(node, utf8_encode(feature.ctype).c_str());
+        NJDNode_set_cform(node, utf8_encode(feature.cform).c_str());
+        NJDNode_set_orig(node, utf8_encode(feature.orig).c_str());
+        NJDNode_set_read(node, utf8_encode(feature.read).c_str());
+        NJDNode_set_pron(node, utf8_encode(feature.pron).c_str());
+        NJDNode_set_acc(node, feature.acc);
+        NJDNode_set_mora_size(node, feature.mora_size);
+        NJDNode_set_chain_rule(node, utf8_encode(feature.chain_rule).c_str());
+        NJDNode_set_chain_flag(node, feature.chain_flag);
         NJD_push_node(njd, node);
     }
 }
 
-bool OpenJtalk::init(const char* path, AssetJNI* assetjni) {
-    if (mecab != nullptr && njd != nullptr && jpcommon != nullptr) return true;
+OpenJtalkContext::OpenJtalkContext() {
+    Mecab_initialize(&mecab);
+    NJD_initialize(&njd);
+    JPCommon_initialize(&jpcommon);
+}
 
-    mecab = new Mecab();
-    njd = new NJD();
-    jpcommon = new JPCommon();
+OpenJtalkContext::~OpenJtalkContext() {
+    Mecab_clear(&mecab);
+    NJD_clear(&njd);
+    JPCommon_clear(&jpcommon);
+}
 
-    Mecab_initialize(mecab);
-    NJD_initialize(njd);
-    JPCommon_initialize(jpcommon);
+OpenJtalkContext* OpenJtalkContext::create(Mecab* dictionary, LabelCache* label_cache) {
+    auto* context = new OpenJtalkContext();
+    context->label_cache = label_cache;
+    if (Mecab_load_shared(&context->mecab, dictionary) != TRUE) {
+        delete context;
+        return nullptr;
+    }
+    return context;
+}
 
-    int r = Mecab_load(mecab, path, assetjni);
-    if (r != 1) {
-        _clear();
-        cerr << path << " not found!" << endl;
-        return false;
+void OpenJtalkContext::convert(const char* text) {
+    mecab_text.resize(max(mecab_text.size(), size_t(text2mecab_size(text))));
+    text2mecab(mecab_text.data(), text);
+}
+
+// MeCab and the njd_set_* passes on the converted text, the result is left in njd
+void OpenJtalkContext::analyze(const char* text) {
+    Mecab_analysis(&mecab, text);
+    mecab2njd(&njd, Mecab_get_feature(&mecab), Mecab_get_size(&mecab));
+    Mecab_refresh(&mecab);
+    njd_set_pronunciation(&njd);
+    njd_set_digit(&njd);
+    njd_set_accent_phrase(&njd);
+    njd_set_accent_type(&njd);
+    njd_set_unvoiced_vowel(&njd);
+    njd_set_long_vowel(&njd);
+}
+
+const vector<const char*>& OpenJtalkContext::extract_labels(const char* text) {
+    convert(text);
+    cache_key.assign(mecab_text.data());
+    label_arena.clear();
+    if (label_cache == nullptr || !label_cache->find(cache_key, label_arena)) {
+        analyze(mecab_text.data());
+        njd2jpcommon(&jpcommon, &njd);
+        JPCommon_make_label(&jpcommon);
+        int label_size = JPCommon_get_label_size(&jpcommon);
+        char** label_feature = JPCommon_get_label_feature(&jpcommon);
+        for (int i = 0; i < label_size; i++) {
+            label_arena.insert(label_arena.end(), label_feature[i],
+                               label_feature[i] + strlen(label_feature[i]) + 1);
+        }
+        JPCommon_refresh(&jpcommon);
+        NJD_refresh(&njd);
+        if (label_cache != nullptr) label_cache->insert(cache_key, label_arena);
     }
-    return true;
+    // views once the arena is complete, it may move while it grows
+    label_views.clear();
+    for (size_t pos = 0; pos < label_arena.size(); pos += strlen(&label_arena[pos]) + 1) {
+        label_views.push_back(&label_arena[pos]);
+    }
+    return label_views;
 }
 
-void OpenJtalk::_clear() {
-    Mecab_clear(mecab);
-    NJD_clear(njd);
-    JPCommon_clear(jpcommon);
-}
-
-vector<Feature*> OpenJtalk::run_frontend(const wstring& text) {
-    string u8text = utf8_encode(text);
-    char buff[8192];
-    text2mecab(buff, u8text.c_str());
-    Mecab_analysis(mecab, buff);
-    mecab2njd(njd, Mecab_get_feature(mecab), Mecab_get_size(mecab));
-    njd_set_pronunciation(njd);
-    njd_set_digit(njd);
-    njd_set_accent_phrase(njd);
-    njd_set_accent_type(njd);
-    njd_set_unvoiced_vowel(njd);
-    njd_set_long_vowel(njd);
-    auto features = njd2feature(njd);
-    NJD_refresh(njd);
-    Mecab_refresh(mecab);
+vector<Feature> OpenJtalkContext::run_frontend(const wstring& text) {
+    convert(utf8_encode(text).c_str());
+    analyze(mecab_text.data());
+    auto features = njd2feature(&njd);
+    NJD_refresh(&njd);
     return features;
 }
 
-vector<wstring> OpenJtalk::make_label(const vector<Feature*>& features) {
-    feature2njd(njd, features);
-    njd2jpcommon(jpcommon, njd);
-    JPCommon_make_label(jpcommon);
-    int label_size = JPCommon_get_label_size(jpcommon);
-    char** label_feature = JPCommon_get_label_feature(jpcommon);
+vector<wstring> OpenJtalkContext::make_label(const vector<Feature>& features) {
+    feature2njd(&njd, features);
+    njd2jpcommon(&jpcommon, &njd);
+    JPCommon_make_label(&jpcommon);
+    int label_size = JPCommon_get_label_size(&jpcommon);
+    char** label_feature = JPCommon_get_label_feature(&jpcommon);
     vector<wstring> labels;
     for (int i = 0; i < label_size; i++) {
         string ts(label_feature[i], strlen(label_feature[i]));
         labels.push_back(utf8_decode(ts));
     }
-    JPCommon_refresh(jpcommon);
-    NJD_refresh(njd);
+    JPCommon_refresh(&jpcommon);
+    NJD_refresh(&njd);
     return labels;
 }
 
+string OpenJtalkContext::words_split(const char* inputs) {
+    auto* tagger = (MeCab::Tagger*) mecab.tagger;
+    const char* result = tagger->parse(inputs);
+    return result != nullptr ? result : "";
+}
+
+OpenJtalk::Lease::Lease(OpenJtalk* owner, OpenJtalkContext* context)
+        : owner(owner), context(context) {}
+
+OpenJtalk::Lease::Lease(Lease&& other) noexcept : owner(other.owner), context(other.context) {
+    other.context = nullptr;
+}
+
+OpenJtalk::Lease::~Lease() {
+    if (context != nullptr) owner->release(context);
+}
+
 OpenJtalk::OpenJtalk() = default;
 
+bool OpenJtalk::init(const char* path, AssetJNI* assetjni) {
+    lock_guard<mutex> guard(pool_lock);
+    if (mecab != nullptr) return true;
+
+    mecab = new Mecab();
+    Mecab_initialize(mecab);
+    int r = Mecab_load(mecab, path, assetjni);
+    if (r != 1) {
+        delete mecab;
+        mecab = nullptr;
+        cerr << path << " not found!" << endl;
+        return false;
+    }
+    return true;
+}
+
+OpenJtalk::Lease OpenJtalk::acquire() {
+    lock_guard<mutex> guard(pool_lock);
+    OpenJtalkContext* context = nullptr;
+    if (!idle.empty()) {
+        context = idle.back();
+        idle.pop_back();
+    } else if (mecab != nullptr) {
+        context = OpenJtalkContext::create(mecab, &label_cache);
+    }
+    return Lease(this, context);
+}
+
+void OpenJtalk::release(OpenJtalkContext* context) {
+    lock_guard<mutex> guard(pool_lock);
+    idle.push_back(context);
+}
+
+vector<Feature> OpenJtalk::run_frontend(const wstring& text) {
+    Lease context = acquire();
+    if (!context) return {};
+    return context->run_frontend(text);
+}
+
+vector<wstring> OpenJtalk::make_label(const vector<Feature>& features) {
+    Lease context = acquire();
+    if (!context) return {};
+    return context->make_label(features);
+}
+
+string OpenJtalk::words_split(const char* inputs) {
+    Lease context = acquire();
+    if (!context) return "";
+    return context->words_split(inputs);
+}
+
 OpenJtalk::~OpenJtalk() {
-    _clear();
+    // every lease must be gone, the contexts use the dictionary
+    for (OpenJtalkContext* context : idle) delete context;
+    if (mecab != nullptr) {
+        Mecab_clear(mecab);
+        delete mecab;
+    }
+}
+
+// cache file: magic, entry count, then per entry, most recently used first, the key size and
+// key followed by the labels size and labels
+#define LABEL_CACHE_MAGIC 0x314C424Cu
+
+static size_t entry_bytes(const string& key, const string& labels) {
+    return key.size() + labels.size();
 }
 
-string OpenJtalk::words_split(const char *inputs) {
-    auto* tagger = (MeCab::Tagger *)mecab->tagger;
-    return tagger->parse(inputs);
+void LabelCache::configure(size_t budget_bytes_) {
+    lock_guard<mutex> guard(lock);
+    budget_bytes = budget_bytes_;
+    while (bytes > budget_bytes && !entries.empty()) {
+        bytes -= entry_bytes(entries.back().key, entries.back().labels);
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
 }
 
+bool LabelCache::find(const string& key, vector<char>& arena) {
+    lock_guard<mutex> guard(lock);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        misses++;
+        return false;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, it->second);
+    const string& labels = it->second->labels;
+    arena.assign(labels.begin(), labels.end());
+    return true;
+}
+
+void LabelCache::insert(const string& key, const vector<char>& arena) {
+    lock_guard<mutex> guard(lock);
+    insert_locked(key, string(arena.begin(), arena.end()));
+}
+
+void LabelCache::insert_locked(const string& key, string labels) {
+    if (entry_bytes(key, labels) > budget_bytes) return;
+    auto it = index.find(key);
+    if (it != index.end()) {
+        bytes -= entry_bytes(key, it->second->labels);
+        entries.erase(it->second);
+    }
+    bytes += entry_bytes(key, labels);
+    entries.push_front({key, std::move(labels)});
+    index[key] = entries.begin();
+    while (bytes > budget_bytes) {
+        bytes -= entry_bytes(entries.back().key, entries.back().labels);
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+void LabelCache::clear() {
+    lock_guard<mutex> guard(lock);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+static bool write_block(FILE* fp, const string& block) {
+    uint32_t size = uint32_t(block.size());
+    return fwrite(&size, sizeof(size), 1, fp) == 1 &&
+           fwrite(block.data(), 1, block.size(), fp) == block.size();
+}
+
+static bool read_block(FILE* fp, string& block) {
+    uint32_t size = 0;
+    if (fread(&size, sizeof(size), 1, fp) != 1 || size > (64u << 20)) return false;
+    block.resize(size);
+    return fread(&block[0], 1, size, fp) == size;
+}
+
+bool LabelCache::save(const string& path) {
+    lock_guard<mutex> guard(lock);
+    // written aside and renamed, a crash leaves the previous file
+    string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "wb");
+    if (fp == nullptr) return false;
+    uint32_t header[2] = {LABEL_CACHE_MAGIC, uint32_t(entries.size())};
+    bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+    for (auto it = entries.begin(); ok && it != entries.end(); ++it) {
+        ok = write_block(fp, it->key) && write_block(fp, it->labels);
+    }
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool LabelCache::load(const string& path) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp == nullptr) return false;
+    uint32_t header[2];
+    vector<Entry> loaded;
+    bool ok = fread(header, sizeof(header), 1, fp) == 1 && header[0] == LABEL_CACHE_MAGIC;
+    for (uint32_t i = 0; ok && i < header[1]; i++) {
+        Entry entry;
+        ok = read_block(fp, entry.key) && read_block(fp, entry.labels);
+        // every label ends with its NUL
+        ok = ok && (entry.labels.empty() || entry.labels.back() == '\0');
+        if (ok) loaded.push_back(std::move(entry));
+    }
+    fclose(fp);
+    if (!ok) return false;
+    lock_guard<mutex> guard(lock);
+    // least recently used first, so the order of the file survives
+    for (auto it = loaded.rbegin(); it != loaded.rend(); ++it) {
+        insert_locked(it->key, std::move(it->labels));
+    }
+    return true;
+}
+
+size_t LabelCache::hit_count() {
+    lock_guard<mutex> guard(lock);
+    return hits;
+}
+
+size_t LabelCache::miss_count() {
+    lock_guard<mutex> guard(lock);
+    return misses;
+}
+
+// byte length of the UTF-8 character starting with lead
+static size_t utf8_length(unsigned char lead) {
+    if (lead < 0xC0) return 1;
+    if (lead < 0xE0) return 2;
+    if (lead < 0xF0) return 3;
+    return 4;
+}
+
+static bool is_one_of(const string& text, size_t pos, size_t len, const char* const* marks) {
+    for (int i = 0; marks[i] != nullptr; i++) {
+        if (strlen(marks[i]) == len && text.compare(pos, len, marks[i]) == 0) return true;
+    }
+    return false;
+}
+
+static const char* const sentence_ends[] = {"。", "．", "！", "？", "!", "?", "\n", nullptr};
+static const char* const sentence_closers[] = {"」", "』", "）", "】", "”", ")", "\"", "'", "…",
+                                               nullptr};
+static const char* const clause_ends[] = {"、", "，", ",", nullptr};
+static const char* const blanks[] = {" ", "\t", "\r", "\n", "　", nullptr};
+
+SentenceSegmenter::SentenceSegmenter(size_t max_chars) : max_chars(max(max_chars, size_t(1))) {}
+
+void SentenceSegmenter::push(const char* text) {
+    pending += text;
+}
+
+void SentenceSegmenter::reset() {
+    pending.clear();
+}
+
+bool SentenceSegmenter::next(string& sentence, bool flush) {
+    while (!pending.empty()) {
+        size_t end = string::npos;
+        size_t last_clause = string::npos;
+        size_t pos = 0;
+        size_t chars = 0;
+        while (pos < pending.size()) {
+            size_t len = utf8_length((unsigned char) pending[pos]);
+            // a character split between two pushes
+            if (pos + len > pending.size()) break;
+            if (is_one_of(pending, pos, len, sentence_ends)) {
+                end = pos + len;
+                while (end < pending.size()) {
+                    size_t next_len = utf8_length((unsigned char) pending[end]);
+                    if (end + next_len > pending.size()) {
+                        if (!flush) return false;
+                        break;
+                    }
+                    if (!is_one_of(pending, end, next_len, sentence_ends) &&
+                        !is_one_of(pending, end, next_len, sentence_closers))
+                        break;
+                    end += next_len;
+                }
+                // the next push may still add closers
+                if (end >= pending.size() && !flush) return false;
+                break;
+            }
+            if (is_one_of(pending, pos, len, clause_ends)) last_clause = pos + len;
+            pos += len;
+            if (++chars >= max_chars) {
+                end = last_clause != string::npos ? last_clause : pos;
+                break;
+            }
+        }
+        if (end == string::npos) {
+            if (!flush) return false;
+            end = pending.size();
+        }
+
+        size_t begin = 0;
+        size_t stop = min(end, pending.size());
+        while (begin < stop) {
+            size_t len = utf8_length((unsigned char) pending[begin]);
+            if (!is_one_of(pending, begin, len, blanks)) break;
+            begin += len;
+        }
+        // blanks are ASCII or the 3 byte ideographic space, no other character ends like them
+        while (stop > begin) {
+            if (is_one_of(pending, stop - 1, 1, blanks)) stop -= 1;
+            else if (stop - begin >= 3 && is_one_of(pending, stop - 3, 3, blanks)) stop -= 3;
+            else break;
+        }
+        sentence.assign(pending, begin, stop - begin);
+        pending.erase(0, end);
+        if (!sentence.empty()) return true;
+    }
+    return false;
+}
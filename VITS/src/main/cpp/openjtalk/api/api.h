@@ -16,6 +16,9 @@
 #include <locale>
 #include <codecvt>
 #include <sstream>
+#include <mutex>
+#include <list>
+#include <unordered_map>
 
 using namespace std;
 typedef unsigned char BYTE;
@@ -55,17 +58,128 @@ int njd_node_get_mora_size(NJDNode * node);
 wstring njd_node_get_chain_rule(NJDNode * node);
 int njd_node_get_chain_flag(NJDNode * node);
 
+// labels of recently analyzed sentences, least recently used out past the budget. Keys are the
+// text as text2mecab hands it to MeCab, so spellings it folds together (half and full width
+// ASCII, control characters) share an entry. The labels of one sentence are kept as a single
+// NUL separated block. save writes the entries to a file that load reads back at startup
+class LabelCache {
+private:
+    struct Entry {
+        string key;
+        string labels;
+    };
+
+    mutex lock;
+    // most recently used first
+    list<Entry> entries;
+    unordered_map<string, list<Entry>::iterator> index;
+    size_t bytes = 0;
+    size_t budget_bytes = size_t(4) << 20;
+    size_t hits = 0;
+    size_t misses = 0;
+
+    void insert_locked(const string& key, string labels);
+public:
+    // 0 disables the cache
+    void configure(size_t budget_bytes);
+    // copies the labels of key into arena, false on a miss
+    bool find(const string& key, vector<char>& arena);
+    void insert(const string& key, const vector<char>& arena);
+    void clear();
+    bool save(const string& path);
+    bool load(const string& path);
+    size_t hit_count();
+    size_t miss_count();
+};
+
+// the state of one analysis: a tagger and lattice on the shared dictionary, NJD, JPCommon and
+// the buffers reused from call to call. Not thread safe, OpenJtalk hands each call a context of
+// its own
+class OpenJtalkContext {
+private:
+    Mecab mecab{};
+    NJD njd{};
+    JPCommon jpcommon{};
+    // the labels of the last extract_labels call, NUL separated, and where each one starts
+    vector<char> label_arena;
+    vector<const char*> label_views;
+    // text2mecab output, grown to the longest text seen
+    vector<char> mecab_text;
+    string cache_key;
+    LabelCache* label_cache{};
+    OpenJtalkContext();
+    void convert(const char* text);
+    void analyze(const char* text);
+public:
+    // nullptr when no tagger can be made on dictionary. label_cache, which may be null, serves
+    // extract_labels
+    static OpenJtalkContext* create(Mecab* dictionary, LabelCache* label_cache);
+    OpenJtalkContext(const OpenJtalkContext&) = delete;
+    OpenJtalkContext& operator=(const OpenJtalkContext&) = delete;
+    ~OpenJtalkContext();
+    // full context labels of one sentence of UTF-8 text. The NJD list MeCab produced goes
+    // through the njd_set_* passes and into JPCommon in place, and the labels are copied into
+    // an arena reused by every call: the views stay valid until the next call on this context
+    const vector<const char*>& extract_labels(const char* text);
+    // the same through wide strings, one Feature per NJD node
+    vector<Feature> run_frontend(const wstring& text);
+    vector<wstring> make_label(const vector<Feature>& features);
+    string words_split(const char* inputs);
+};
+
+// the MeCab dictionary, loaded once and only read afterwards, and a pool of contexts on it.
+// Threads analyze in parallel on contexts checked out with acquire(), the pool grows to the
+// most calls that ever ran at once
 class OpenJtalk {
 private:
     Mecab* mecab{};
-    NJD* njd{};
-    JPCommon* jpcommon{};
-    void _clear();
+    LabelCache label_cache;
+    mutex pool_lock;
+    vector<OpenJtalkContext*> idle;
+    void release(OpenJtalkContext* context);
 public:
+    // a checked out context, back in the pool when the lease goes
+    class Lease {
+    private:
+        OpenJtalk* owner;
+        OpenJtalkContext* context;
+    public:
+        Lease(OpenJtalk* owner, OpenJtalkContext* context);
+        Lease(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        ~Lease();
+        // false before init
+        explicit operator bool() const { return context != nullptr; }
+        OpenJtalkContext* operator->() const { return context; }
+    };
+
     OpenJtalk();
     bool init(const char* path, AssetJNI* assetjni);
-    vector<Feature*> run_frontend(const wstring& text);
-    vector<wstring> make_label(const vector<Feature*>& features);
+    Lease acquire();
+    // shared by every context
+    LabelCache& labels() { return label_cache; }
+    // one call each on a context of its own
+    vector<Feature> run_frontend(const wstring& text);
+    vector<wstring> make_label(const vector<Feature>& features);
     string words_split(const char* inputs);
     ~OpenJtalk();
 };
+
+// cuts UTF-8 text that arrives in pieces, such as a streamed reply, into sentences as soon as
+// each one is complete, so the frontend and synthesis can start before the rest is known. A
+// sentence ends after 。．！？!? or a line break together with the closing brackets and marks
+// right behind them. One without an end that grows past max_chars characters is cut after its
+// last 、 or ，, or at max_chars when it has none
+class SentenceSegmenter {
+private:
+    string pending;
+    size_t max_chars;
+public:
+    explicit SentenceSegmenter(size_t max_chars = 100);
+    void push(const char* text);
+    // the next complete sentence without surrounding blanks. flush takes the rest as complete,
+    // at the end of the input. False when no sentence is ready
+    bool next(string& sentence, bool flush = false);
+    void reset();
+};
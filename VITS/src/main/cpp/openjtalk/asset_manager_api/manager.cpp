@@ -1,18 +1,91 @@
 #include "manager.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-unsigned char* asset_loader(const char * fileName, AssetJNI* asjni, int* fd, size_t *length){
+// maps length bytes at offset of fd, which need not be page aligned. The tables inside are read
+// as ints, so a start the heap would align better is left to the copy
+static bool map_range(int fd, off_t offset, size_t length, AssetData* asset) {
+    if (length == 0 || offset % sizeof(int) != 0) return false;
+    off_t page = sysconf(_SC_PAGESIZE);
+    off_t base = offset / page * page;
+    size_t map_length = length + size_t(offset - base);
+    void* p = mmap(nullptr, map_length, PROT_READ, MAP_PRIVATE, fd, base);
+    if (p == MAP_FAILED) return false;
+    asset->map_base = p;
+    asset->map_length = map_length;
+    asset->data = (const unsigned char*) p + (offset - base);
+    asset->length = length;
+    return true;
+}
+
+void asset_unmap(AssetData* asset) {
+    if (asset->map_base != nullptr) {
+        munmap(asset->map_base, asset->map_length);
+    } else {
+        delete[] asset->data;
+    }
+    *asset = AssetData();
+}
+
+#ifdef __ANDROID__
+bool asset_map(const char * fileName, AssetJNI* asjni, AssetData* asset){
+    *asset = AssetData();
     AAssetManager* mgr = AAssetManager_fromJava(asjni->env, asjni->assetManager);
-    AAsset* asset = AAssetManager_open(mgr, fileName, AASSET_MODE_BUFFER);
-    unsigned char* buff = nullptr;
-    if (asset) {
-        *length = AAsset_getLength(asset);
-        buff = new unsigned char[*length + 1];
-        buff[*length] = 0;
-        AAsset_read(asset, buff, *length);
-        AAsset_close(asset);
-        *fd = 0;
-        return buff;
+    AAsset* asset_file = AAssetManager_open(mgr, fileName, AASSET_MODE_RANDOM);
+    if (!asset_file) return false;
+    // only assets stored uncompressed have a descriptor, see noCompress in the app's gradle
+    off64_t start = 0, length = 0;
+    int fd = AAsset_openFileDescriptor64(asset_file, &start, &length);
+    if (fd >= 0) {
+        bool mapped = map_range(fd, start, size_t(length), asset);
+        ::close(fd);
+        if (mapped) {
+            AAsset_close(asset_file);
+            return true;
+        }
+    }
+    size_t size = AAsset_getLength(asset_file);
+    unsigned char* buff = new unsigned char[size + 1];
+    buff[size] = 0;
+    bool ok = AAsset_read(asset_file, buff, size) == int(size);
+    AAsset_close(asset_file);
+    if (!ok) {
+        delete[] buff;
+        return false;
+    }
+    asset->data = buff;
+    asset->length = size;
+    return true;
+}
+#else
+bool asset_map(const char * fileName, AssetJNI* asjni, AssetData* asset){
+    *asset = AssetData();
+    std::string path = asjni->assetManager->path(fileName);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st{};
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && !map_range(fd, 0, size_t(st.st_size), asset)) {
+        size_t size = size_t(st.st_size);
+        unsigned char* buff = new unsigned char[size + 1];
+        buff[size] = 0;
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::read(fd, buff + done, size - done);
+            if (n <= 0) break;
+            done += size_t(n);
+        }
+        ok = done == size;
+        if (ok) {
+            asset->data = buff;
+            asset->length = size;
+        } else {
+            delete[] buff;
+        }
     }
-    *fd = -1;
-    return buff;
-}
\ No newline at end of file
+    ::close(fd);
+    return ok;
+}
+#endif
@@ -1,11 +1,16 @@
 #ifndef MOERENG_MANAGER_H
 #define MOERENG_MANAGER_H
 #include <iostream>
+#include <string>
+
+#ifdef __ANDROID__
 #include <android/asset_manager.h>
 #include <android/asset_manager_jni.h>
+#endif
 
 using namespace std;
 
+#ifdef __ANDROID__
 struct AssetJNI {
     JNIEnv* env;
     jobject obj;
@@ -16,7 +21,37 @@ struct AssetJNI {
         assetManager = _assetManager;
     }
 };
+#else
+// host builds have no apk, "assets" are plain files below root
+struct AAssetManager {
+    std::string root;
+    explicit AAssetManager(const std::string& _root) : root(_root) {}
+    std::string path(const char* fileName) const {
+        if (root.empty()) return fileName;
+        return root + "/" + fileName;
+    }
+};
+
+struct AssetJNI {
+    AAssetManager* assetManager;
+    explicit AssetJNI(AAssetManager* _assetManager){
+        assetManager = _assetManager;
+    }
+};
+#endif
+
+// the bytes of an asset, read only. Mapped straight from the file when it can be (an asset
+// stored uncompressed in the apk, or a plain file on host builds) and copied to the heap
+// otherwise, so the dictionary costs page cache rather than private memory
+struct AssetData {
+    const unsigned char* data = nullptr;
+    size_t length = 0;
+    // the mapping to undo, nullptr when data is a heap copy
+    void* map_base = nullptr;
+    size_t map_length = 0;
+};
 
-unsigned char* asset_loader(const char* fileName, AssetJNI* asjni, int* fd, size_t *length);
+bool asset_map(const char* fileName, AssetJNI* asjni, AssetData* asset);
+void asset_unmap(AssetData* asset);
 
 #endif //MOERENG_MANAGER_H
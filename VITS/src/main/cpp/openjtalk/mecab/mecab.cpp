@@ -71,6 +71,7 @@ BOOL Mecab_initialize(Mecab *m)
    m->model = NULL;
    m->tagger = NULL;
    m->lattice = NULL;
+   m->shared_model = FALSE;
    return TRUE;
 }
 
@@ -127,6 +128,34 @@ BOOL Mecab_load(Mecab *m, const char *dicdir, AssetJNI* asjni)
    return TRUE;
 }
 
+/* a tagger and lattice of its own on the dictionary source loaded, which must outlive m.
+   Analysis only reads the model, so both can run on different threads */
+BOOL Mecab_load_shared(Mecab *m, Mecab *source)
+{
+   if(m == NULL || source == NULL || source->model == NULL)
+      return FALSE;
+
+   Mecab_clear(m);
+
+   MeCab::Model *model = (MeCab::Model *) source->model;
+   MeCab::Tagger *tagger = model->createTagger();
+   if(tagger == NULL)
+      return FALSE;
+
+   MeCab::Lattice *lattice = model->createLattice();
+   if(lattice == NULL) {
+      delete tagger;
+      return FALSE;
+   }
+
+   m->model = (void *) model;
+   m->tagger = (void *) tagger;
+   m->lattice = (void *) lattice;
+   m->shared_model = TRUE;
+
+   return TRUE;
+}
+
 BOOL Mecab_analysis(Mecab *m, const char *str)
 {
    if(m->model == NULL || m->tagger == NULL || m->lattice == NULL || str == NULL)
@@ -222,8 +251,10 @@ BOOL Mecab_clear(Mecab *m)
 
    if(m->model) {
       MeCab::Model *model = (MeCab::Model *) m->model;
-      delete model;
+      if(!m->shared_model)
+         delete model;
       m->model = NULL;
+      m->shared_model = FALSE;
    }
 
    return TRUE;
@@ -1587,10 +1587,12 @@ typedef struct _Mecab{
    void *model;
    void *tagger;
    void *lattice;
+   BOOL shared_model;
 } Mecab;
 
 BOOL Mecab_initialize(Mecab *m);
 BOOL Mecab_load(Mecab *m, const char *dicdir, AssetJNI* asjni);
+BOOL Mecab_load_shared(Mecab *m, Mecab *source);
 BOOL Mecab_analysis(Mecab *m, const char *str);
 BOOL Mecab_print(Mecab *m);
 int Mecab_get_size(Mecab *m);
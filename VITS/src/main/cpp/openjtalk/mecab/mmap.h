@@ -66,8 +66,7 @@ template <class T> class Mmap {
   size_t       length;
   std::string  fileName;
   whatlog what_;
-  int    fd;
-  int    flag;
+  AssetData    asset;
 
  public:
   T&       operator[](size_t n)       { return *(text + n); }
@@ -85,24 +84,25 @@ template <class T> class Mmap {
   // This code is imported from sufary, develoved by
   //  TATUO Yamashita <yto@nais.to> Thanks!
 
+  // the file is mapped read only whatever mode asks for, nothing writes to a dictionary
   bool open(const char *filename, AssetJNI* asjni, const char *mode = "r") {
+    this->close();
     fileName = std::string(filename);
-    unsigned char * buff = asset_loader(filename, asjni, &fd, &length);
-    CHECK_FALSE(fd >= 0) << "open failed: " << filename;
-    text = reinterpret_cast<T *>(buff);
-    CHECK_FALSE(text) << "MapViewOfFile() failed: " << filename;
+    CHECK_FALSE(asset_map(filename, asjni, &asset)) << "open failed: " << filename;
+    text = reinterpret_cast<T *>(const_cast<unsigned char *>(asset.data));
+    length = asset.length;
     return true;
   }
 
   void close() {
     if (text) {
-      ::munmap(reinterpret_cast<char *>(text), length);
+      asset_unmap(&asset);
       text = 0;
     }
-    text = 0;
+    length = 0;
   }
 
-  Mmap(): text(0), fd(-1) {}
+  Mmap(): text(0), length(0) {}
   virtual ~Mmap() { this->close(); }
 };
 }
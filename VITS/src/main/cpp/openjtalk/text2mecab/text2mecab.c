@@ -94,7 +94,8 @@ static int strtopcmp(const char *str, const char *pattern)
    }
 }
 
-void text2mecab(char* output, const char*input)
+/* writes to output unless it is NULL, returns the converted length without the terminator */
+static int text2mecab_convert(char* output, const char*input)
 {
     int i, j;
     const int length = strlen(input);
@@ -114,8 +115,9 @@ void text2mecab(char* output, const char*input)
             /* convert */
             s += e;
             str = text2mecab_conv_list[i + 1];
-            for (j = 0; str[j] != '\0'; j++)
-                output[index++] = str[j];
+            for (j = 0; str[j] != '\0'; j++, index++)
+                if (output != NULL)
+                    output[index] = str[j];
         }
         else if (text2mecab_control_range[0] <= str[0] && str[0] <= text2mecab_control_range[1]) {
             /* control character */
@@ -131,17 +133,31 @@ void text2mecab(char* output, const char*input)
                 }
             }
             if (e > 0) {
-                for (j = 0; j < e; j++)
-                    output[index++] = input[s++];
+                for (j = 0; j < e && s < length; j++, index++, s++)
+                    if (output != NULL)
+                        output[index] = input[s];
             }
             else {
                 /* unknown */
-                fprintf(stderr, "WARNING: openjtalk.text2mecab() in openjtalk.text2mecab.c: Wrong character.\n");
+                if (output != NULL)
+                    fprintf(stderr, "WARNING: openjtalk.text2mecab() in openjtalk.text2mecab.c: Wrong character.\n");
                 s++;
             }
         }
     }
-   output[index] = '\0';
+    if (output != NULL)
+        output[index] = '\0';
+    return index;
+}
+
+int text2mecab_size(const char* input)
+{
+    return text2mecab_convert(NULL, input) + 1;
+}
+
+void text2mecab(char* output, const char*input)
+{
+    text2mecab_convert(output, input);
 }
 
 TEXT2MECAB_C_END;
@@ -51,6 +51,9 @@
 
 TEXT2MECAB_H_START;
 
+/* output must hold text2mecab_size(input) bytes, conversion can make the text longer */
+int text2mecab_size(const char* input);
+
 void text2mecab(char * output, const char* input);
 
 TEXT2MECAB_H_END;
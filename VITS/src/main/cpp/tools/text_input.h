@@ -0,0 +1,141 @@
+// text input shared by the command line tools: the japanese cleaners and symbol lookup the app
+// runs before calling into the engine
+#ifndef TOOLS_TEXT_INPUT_H
+#define TOOLS_TEXT_INPUT_H
+
+#include <fstream>
+#include <regex>
+#include "utils.h"
+#include "../openjtalk/api/api.h"
+
+static std::vector<int> parse_ids(const std::string &s) {
+    std::vector<int> ids;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) ids.push_back(atoi(item.c_str()));
+    }
+    return ids;
+}
+
+static std::vector<std::string> load_symbols(const std::string &path) {
+    std::vector<std::string> symbols;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        symbols.push_back(line);
+    }
+    return symbols;
+}
+
+// same character classes as JapaneseCleaners._japanese_characters
+static bool is_japanese_character(wchar_t c) {
+    return (c >= L'A' && c <= L'Z') || (c >= L'a' && c <= L'z') || (c >= L'0' && c <= L'9') ||
+           c == 0x3005 || (c >= 0x3040 && c <= 0x30ff) || (c >= 0x4e00 && c <= 0x9fff) ||
+           (c >= 0xff11 && c <= 0xff19) || (c >= 0xff21 && c <= 0xff3a) ||
+           (c >= 0xff41 && c <= 0xff5a) || (c >= 0xff66 && c <= 0xff9d);
+}
+
+static int label_field(const std::string &label, const std::regex &pattern) {
+    std::smatch m;
+    if (!std::regex_search(label, m, pattern)) return 0;
+    return atoi(m[1].str().c_str());
+}
+
+// c++ port of JapaneseCleaners.japanese_clean_text1
+static std::string japanese_cleaners(OpenJtalk &openJtalk, const std::string &input) {
+    static const std::regex phoneme_re("\\-([^\\+]*)\\+");
+    static const std::regex a1_re("/A:(\\-?[0-9]+)\\+");
+    static const std::regex a2_re("\\+(\\d+)\\+");
+    static const std::regex a3_re("\\+(\\d+)/");
+
+    // runs of japanese characters, each analyzed on its own, and the marks between them
+    std::wstring text = utf8_decode(input);
+    std::vector<std::string> sentences;
+    std::vector<std::wstring> marks;
+    std::wstring sentence;
+    for (size_t i = 0; i <= text.size(); i++) {
+        if (i < text.size() && is_japanese_character(text[i])) {
+            sentence.push_back(text[i]);
+            continue;
+        }
+        if (!sentence.empty()) {
+            sentences.push_back(utf8_encode(sentence));
+            marks.emplace_back();
+            sentence.clear();
+        }
+        if (i == text.size()) break;
+        if (marks.empty()) {
+            sentences.emplace_back();
+            marks.emplace_back();
+        }
+        marks.back().push_back(text[i]);
+    }
+
+    // sentences are independent, each thread checks out an OpenJtalk context of its own
+    std::vector<std::vector<std::string>> sentence_labels(sentences.size());
+    #pragma omp parallel for schedule(dynamic)
+    for (int s = 0; s < int(sentences.size()); s++) {
+        if (sentences[s].empty()) continue;
+        OpenJtalk::Lease context = openJtalk.acquire();
+        if (!context) continue;
+        const auto &views = context->extract_labels(sentences[s].c_str());
+        sentence_labels[s].assign(views.begin(), views.end());
+    }
+
+    std::string cleaned;
+    for (size_t s = 0; s < sentences.size(); s++) {
+        const std::vector<std::string> &labels = sentence_labels[s];
+        if (!sentences[s].empty() && !cleaned.empty()) cleaned += " ";
+        for (size_t n = 0; n + 1 < labels.size(); n++) {
+            std::smatch m;
+            std::regex_search(labels[n], m, phoneme_re);
+            std::string phoneme = m[1].str();
+            if (phoneme == "sil" || phoneme == "pau") continue;
+            phoneme = std::regex_replace(phoneme, std::regex("ch"), "ʧ");
+            phoneme = std::regex_replace(phoneme, std::regex("sh"), "ʃ");
+            phoneme = std::regex_replace(phoneme, std::regex("cl"), "Q");
+            cleaned += phoneme;
+
+            int a1 = label_field(labels[n], a1_re);
+            int a2 = label_field(labels[n], a2_re);
+            int a3 = label_field(labels[n], a3_re);
+            std::smatch next;
+            std::regex_search(labels[n + 1], next, phoneme_re);
+            int a2_next = -1;
+            if (next[1].str() != "sil" && next[1].str() != "pau") {
+                a2_next = label_field(labels[n + 1], a2_re);
+            }
+            // accent phrase boundary
+            if (a3 == 1 && a2_next == 1) cleaned += " ";
+            else if (a1 == 0 && a2_next == a2 + 1) cleaned += "↓";
+            else if (a2 == 1 && a2_next == 2) cleaned += "↑";
+        }
+        for (wchar_t c: marks[s]) {
+            if (c != L' ') cleaned += utf8_encode(std::wstring(1, c));
+        }
+    }
+    if (!cleaned.empty() && isalpha((unsigned char) cleaned.back())) cleaned += ".";
+    return cleaned;
+}
+
+// symbols to ids with blanks in between, mirrors JapaneseTextUtils.wordsToLabels
+static std::vector<int> text_to_ids(const std::string &cleaned,
+                                    const std::vector<std::string> &symbols) {
+    std::vector<int> ids{0};
+    std::wstring text = utf8_decode(cleaned);
+    for (size_t i = 0; i < text.size(); i++) {
+        std::string c = utf8_encode(text.substr(i, 1));
+        for (size_t s = 0; s < symbols.size(); s++) {
+            if (symbols[s] == c) {
+                ids.push_back(int(s));
+                ids.push_back(0);
+                break;
+            }
+        }
+    }
+    return ids;
+}
+
+#endif
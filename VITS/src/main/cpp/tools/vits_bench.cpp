@@ -0,0 +1,555 @@
+// benchmark of every stage of the VITS pipeline, prints one JSON document on stdout
+//
+// vits_bench [--model <folder> --assets <folder> [--multi] [--n_vocab n]]
+//            [--lengths 16,32,64,128] [--threads 1,2,4] [--runs 10] [--warmup 2]
+//            [--sampling_rate 22050] [--check] [--no-mmap]
+//
+// without --model only the helpers of vits/utils.cpp are measured, on inputs shaped like the
+// ones forward produces for a sentence of the given token length. --check compares the optimized
+// helpers and the fused attention layer against reference implementations first and exits with
+// 1 on a mismatch, with --model the packed sentence latents and with --multi the speaker
+// embeddings and voice conversion as well. --no-mmap loads the weights onto the heap instead
+// of mapping them, the load time is reported as stage "load"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <sys/resource.h>
+#include "SynthesizerTrn.h"
+#include "custom_layers.h"
+
+// frames per token and samples per frame used to size the synthetic helper inputs
+#define FRAMES_PER_TOKEN 6
+#define HOP_LENGTH 256
+#define HIDDEN_CHANNELS 192
+// heads, channels per head and relative window of the Attention layer
+#define ATTENTION_HEADS 2
+#define ATTENTION_CHANNELS 96
+#define ATTENTION_WINDOW 4
+
+// counts live and peak bytes handed out, for the allocator usage column
+class CountingAllocator : public ncnn::Allocator {
+public:
+    void *fastMalloc(size_t size) override {
+        void *ptr = ncnn::fastMalloc(size);
+        std::lock_guard<std::mutex> lock(mutex);
+        sizes[ptr] = size;
+        current += size;
+        peak = std::max(peak, current);
+        return ptr;
+    }
+
+    void fastFree(void *ptr) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = sizes.find(ptr);
+            if (it != sizes.end()) {
+                current -= it->second;
+                sizes.erase(it);
+            }
+        }
+        ncnn::fastFree(ptr);
+    }
+
+    void reset_peak() {
+        std::lock_guard<std::mutex> lock(mutex);
+        peak = current;
+    }
+
+    size_t peak_bytes() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return peak;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<void *, size_t> sizes;
+    size_t current = 0;
+    size_t peak = 0;
+};
+
+struct BenchResult {
+    std::string stage;
+    int length;
+    int threads;
+    double p50;
+    double p95;
+    double rtf;
+    size_t peak_bytes;
+};
+
+static std::vector<int> parse_list(const std::string &s) {
+    std::vector<int> values;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) values.push_back(atoi(item.c_str()));
+    }
+    return values;
+}
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t index = size_t(std::ceil(p * double(values.size())));
+    if (index > 0) index--;
+    return values[std::min(index, values.size() - 1)];
+}
+
+static Mat filled(int w, int h, float value) {
+    Mat m(w, h);
+    m.fill(value);
+    return m;
+}
+
+// the plain i-j-k product matmul used to be, reference for the packed gemm
+static Mat reference_matmul(const Mat &m1, const Mat &m2) {
+    Mat res(m2.w, m1.h, m1.c);
+    for (int i = 0; i < m1.c; i++) {
+        const float *p1 = m1.channel(i);
+        const float *p2 = m2.channel(i);
+        float *p = res.channel(i);
+        for (int j = 0; j < m1.h; j++) {
+            for (int k = 0; k < m2.w; k++) {
+                float sum = 0;
+                for (int n = 0; n < m2.h; n++) sum += p1[n] * p2[k + n * m2.w];
+                *p++ = sum;
+            }
+            p1 += m1.w;
+        }
+    }
+    return res;
+}
+
+static float max_abs_diff(const Mat &a, const Mat &b) {
+    if (a.w != b.w || a.h != b.h || a.c != b.c) return FLT_MAX;
+    float diff = 0;
+    for (int q = 0; q < a.c; q++) {
+        const float *pa = a.channel(q);
+        const float *pb = b.channel(q);
+        for (int i = 0; i < a.w * a.h; i++) diff = std::max(diff, std::fabs(pa[i] - pb[i]));
+    }
+    return diff;
+}
+
+static Mat random_mat(int w, int h, int c, std::mt19937 &gen) {
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    Mat m(w, h, c);
+    for (int q = 0; q < c; q++) {
+        float *p = m.channel(q);
+        for (int i = 0; i < w * h; i++) p[i] = dist(gen);
+    }
+    return m;
+}
+
+// the Attention layer before it was fused: reshape / matmul per head, the relative position
+// round trips and a separate softmax, with the element wise mask_fill
+static Mat reference_attention(const Mat &query_, const Mat &key_, const Mat &value_,
+                               const Mat &attn_mask, const Mat &emb_rel_k, const Mat &emb_rel_v,
+                               const Option &opt) {
+    const int n_heads = ATTENTION_HEADS;
+    const int k_channels = ATTENTION_CHANNELS;
+    const int window_size = ATTENTION_WINDOW;
+    Mat attn_mask_t = mattranspose(attn_mask, opt);
+    Mat mask = matmul(attn_mask_t, attn_mask, opt);
+
+    int t_t = query_.w;
+    int t_s = key_.w;
+    int d = key_.h;
+
+    Mat query = mattranspose(query_.reshape(t_t, k_channels, n_heads), opt);
+    Mat key = mattranspose(key_.reshape(t_t, k_channels, n_heads), opt);
+    Mat value = mattranspose(value_.reshape(t_t, k_channels, n_heads), opt);
+
+    Mat scores = matmul(div(query, sqrt(k_channels), opt), mattranspose(key, opt), opt);
+    Mat key_relative_embeddings = get_relative_embeddings(emb_rel_k, t_s, window_size, opt);
+    Mat rel_logits = matmul_with_relative_keys(div(query, sqrt(k_channels), opt),
+                                                key_relative_embeddings, opt);
+    scores = matplus(scores, relative_position_to_absolute_position(rel_logits, opt), opt);
+    mask_fill(scores, mask, "=", 0, -1e4, opt);
+    Mat p_attn = softmax(scores, opt);
+
+    Mat output = matmul(p_attn, value, opt);
+    Mat relative_weights = absolute_position_to_relative_position(p_attn, opt);
+    Mat value_relative_embeddings = get_relative_embeddings(emb_rel_v, t_s, window_size, opt);
+    output = matplus(output, matmul_with_relative_values(relative_weights,
+                                                         value_relative_embeddings, opt), opt);
+    output = mattranspose(output, opt);
+    return output.reshape(t_t, d);
+}
+
+// runs every optimized helper against its reference, prints one line per case on stderr
+static bool run_checks(const std::vector<int> &lengths, const Option &opt) {
+    struct Shape {
+        int m, n, k, c;
+    };
+    std::vector<Shape> shapes{{1, 1, 1, 1}, {3, 5, 7, 1}, {4, 8, 1, 1}, {13, 17, 9, 2},
+                              {33, 191, 65, 1}};
+    for (int length: lengths) {
+        // attn x m_p and the attention scores of the encoder
+        shapes.push_back({length * FRAMES_PER_TOKEN, HIDDEN_CHANNELS, length, 1});
+        shapes.push_back({length, length, HIDDEN_CHANNELS / 2, 2});
+    }
+    std::mt19937 gen(1234);
+    bool ok = true;
+    for (const Shape &s: shapes) {
+        Mat a = random_mat(s.k, s.m, s.c, gen);
+        Mat b = random_mat(s.n, s.k, s.c, gen);
+        float diff = max_abs_diff(matmul(a, b, opt), reference_matmul(a, b));
+        bool pass = diff <= 1e-5f * float(s.k);
+        fprintf(stderr, "check matmul %dx%dx%d c=%d: max diff %g %s\n", s.m, s.n, s.k, s.c, diff,
+                pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+
+    for (int length: lengths) {
+        // uneven durations with a masked token, expanded both ways
+        Mat x = random_mat(length, HIDDEN_CHANNELS, 1, gen);
+        Mat w_ceil(length, 1);
+        Mat x_mask(length, 1);
+        for (int i = 0; i < length; i++) {
+            w_ceil[i] = float(i == length / 2 ? 0 : 1 + gen() % (2 * FRAMES_PER_TOKEN));
+            x_mask[i] = i == length / 2 ? 0.f : 1.f;
+        }
+        Mat summed = sum(w_ceil, opt);
+        Mat y_mask = reducedims(mattranspose(sequence_mask(summed, opt, summed[0]), opt));
+        Mat attn = generate_path(w_ceil, reducedims(matmul(y_mask, x_mask, opt)), opt);
+        Mat dense = reducedims(mattranspose(
+                reference_matmul(attn, reducedims(mattranspose(x, opt))), opt));
+        Mat sparse = expand_by_duration(x, w_ceil, int(summed[0]), opt);
+        float diff = max_abs_diff(reducedims(sparse), dense);
+        bool pass = diff == 0;
+        fprintf(stderr, "check expand_by_duration t_x=%d: max diff %g %s\n", length, diff,
+                pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+
+    // fused attention against the old layer, longer than the relative window on both sides and
+    // with a padded tail, so the window edges and the masked rows and columns are covered
+    for (int length: lengths) {
+        int t = std::max(length, 2 * ATTENTION_WINDOW + 3);
+        Mat query = random_mat(t, HIDDEN_CHANNELS, 1, gen).reshape(t, HIDDEN_CHANNELS);
+        Mat key = random_mat(t, HIDDEN_CHANNELS, 1, gen).reshape(t, HIDDEN_CHANNELS);
+        Mat value = random_mat(t, HIDDEN_CHANNELS, 1, gen).reshape(t, HIDDEN_CHANNELS);
+        Mat emb_rel_k = random_mat(ATTENTION_CHANNELS, 2 * ATTENTION_WINDOW + 1, 1, gen)
+                .reshape(ATTENTION_CHANNELS, 2 * ATTENTION_WINDOW + 1);
+        Mat emb_rel_v = random_mat(ATTENTION_CHANNELS, 2 * ATTENTION_WINDOW + 1, 1, gen)
+                .reshape(ATTENTION_CHANNELS, 2 * ATTENTION_WINDOW + 1);
+        Mat mask(t, 1);
+        int padding = std::max(t / 4, 1);
+        for (int i = 0; i < t; i++) mask[i] = i < t - padding ? 1.f : 0.f;
+
+        Attention attention;
+        std::vector<Mat> bottoms{emb_rel_k, emb_rel_v, mask, key, query, value};
+        std::vector<Mat> tops(1);
+        int ret = attention.forward(bottoms, tops, opt);
+        Mat reference = reference_attention(query, key, value, mask, emb_rel_k, emb_rel_v, opt);
+        float diff = ret != 0 ? FLT_MAX : max_abs_diff(tops[0], reference);
+        bool pass = diff <= 1e-4f;
+        fprintf(stderr, "check attention t=%d padding=%d: max diff %g %s\n", t, padding, diff,
+                pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+
+    // the noise of one seed must not depend on the thread count
+    for (int length: lengths) {
+        Option single = opt;
+        single.num_threads = 1;
+        Mat serial, threaded;
+        {
+            NoiseScope noise(42);
+            serial = randn(length * FRAMES_PER_TOKEN, HIDDEN_CHANNELS, single);
+        }
+        {
+            NoiseScope noise(42);
+            threaded = randn(length * FRAMES_PER_TOKEN, HIDDEN_CHANNELS, opt);
+        }
+        float diff = max_abs_diff(serial, threaded);
+        bool pass = diff == 0;
+        fprintf(stderr, "check randn t_y=%d: max diff %g %s\n", length * FRAMES_PER_TOKEN, diff,
+                pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+    return ok;
+}
+
+// speaker_embedding against the gather / transpose / reducedims of emb_g forward used to run:
+// the same values in the same 2-d (1 x 256) layout. Then a multi speaker forward per checked
+// sid, which must give audio and, run again, the same audio
+static bool run_speaker_checks(SynthesizerTrn &net_g, const Option &opt) {
+    bool ok = true;
+    int count = net_g.speaker_count();
+    if (count == 0) {
+        fprintf(stderr, "check speakers: emb_g not loaded FAILED\n");
+        return false;
+    }
+    std::vector<int> sids{0, count / 2, count - 1};
+    for (int sid: sids) {
+        Mat sid_mat(1);
+        sid_mat[0] = float(sid);
+        Mat reference = reducedims(
+                mattranspose(embedding(sid_mat, net_g.speaker_table(), opt), opt));
+        Mat g = net_g.speaker_embedding(sid);
+        bool pass = g.dims == reference.dims && max_abs_diff(g, reference) == 0;
+        Mat x(8);
+        for (int i = 0; i < x.w; i++) x[i] = float(i % 2 == 0 ? 0 : 1 + i);
+        Mat audio = net_g.forward(x, opt, false, true, sid, .667f, .8f, 1.f, 7);
+        Mat again = net_g.forward(x, opt, false, true, sid, .667f, .8f, 1.f, 7);
+        pass = pass && !audio.empty() && max_abs_diff(audio, again) == 0;
+        fprintf(stderr, "check speaker %d: g %dx%d, forward %d samples %s\n", sid, g.w, g.h,
+                audio.w * audio.h, pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+    // voice conversion hands the same g to enc_q, flow, flow.reverse and dec: speech of the first
+    // speaker converted to the last one, twice under one seed
+    if (net_g.load(true)) {
+        Mat x(8);
+        for (int i = 0; i < x.w; i++) x[i] = float(i % 2 == 0 ? 0 : 1 + i);
+        Mat speech = net_g.forward(x, opt, false, true, 0, .667f, .8f, 1.f, 7);
+        // a single row, as the JNI layer passes recorded audio
+        Mat source = speech.empty() ? Mat() : speech.reshape(speech.w * speech.h, 1);
+        Mat converted, again;
+        if (!source.empty()) {
+            converted = net_g.voice_convert(source, 0, count - 1, opt, false, 7);
+            again = net_g.voice_convert(source, 0, count - 1, opt, false, 7);
+        }
+        int length = converted.w * converted.h;
+        bool pass = !converted.empty() && max_abs_diff(converted, again) == 0 &&
+                    std::abs(length - source.w) < 1024;
+        fprintf(stderr, "check voice convert 0 -> %d: %d -> %d samples %s\n", count - 1,
+                source.w, length, pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    } else {
+        fprintf(stderr, "check voice convert: %s, skipped\n", net_g.load_error().c_str());
+    }
+    bool rejected = net_g.speaker_embedding(count).empty();
+    fprintf(stderr, "check speaker %d out of range: %s\n", count, rejected ? "ok" : "FAILED");
+    return ok && rejected;
+}
+
+// sentences of different lengths and tokens packed into one enc_p / dp pass, each latent and
+// mask must match what prepare_latent gives for that sentence alone under the same seed
+static bool run_pack_checks(SynthesizerTrn &net_g, bool multi, int n_vocab, const Option &opt) {
+    int vocab = n_vocab > 1 ? n_vocab : 2;
+    std::vector<int> lengths{9, 17, 6, 31};
+    std::vector<Mat> sentences;
+    for (size_t s = 0; s < lengths.size(); s++) {
+        Mat x(lengths[s], 1);
+        float *p = x;
+        for (int i = 0; i < x.w; i++)
+            p[i] = float(i % 2 == 0 ? 0 : 1 + (i * int(s + 3) + int(s)) % (vocab - 1));
+        sentences.push_back(x);
+    }
+    int sid = multi ? net_g.speaker_count() / 2 : 0;
+    std::vector<Mat> z_ps, y_masks;
+    Mat g;
+    if (!net_g.prepare_latents(sentences, opt, false, multi, sid, .667f, .8f, 1.f, 7, z_ps,
+                               y_masks, g)) {
+        fprintf(stderr, "check packed latents: prepare_latents FAILED\n");
+        return false;
+    }
+    bool ok = true;
+    for (size_t s = 0; s < sentences.size(); s++) {
+        Mat z_p, y_mask, g_single;
+        net_g.prepare_latent(sentences[s], opt, false, multi, sid, .667f, .8f, 1.f, 7, z_p,
+                             y_mask, g_single);
+        float z_diff = z_p.empty() ? FLT_MAX : max_abs_diff(z_ps[s], z_p);
+        float mask_diff = y_mask.empty() ? FLT_MAX : max_abs_diff(y_masks[s], y_mask);
+        bool pass = z_diff <= 1e-4f && mask_diff == 0;
+        fprintf(stderr, "check packed latent %zu (t_x=%d, t_y=%d): z_p %g, y_mask %g %s\n", s,
+                sentences[s].w, z_p.w, z_diff, mask_diff, pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+    return ok;
+}
+
+template<typename F>
+static std::vector<double> measure(int runs, int warmup, F &&fn) {
+    for (int i = 0; i < warmup; i++) fn();
+    std::vector<double> times;
+    for (int i = 0; i < runs; i++) {
+        double start = get_current_time();
+        fn();
+        times.push_back(get_current_time() - start);
+    }
+    return times;
+}
+
+int main(int argc, char **argv) {
+    std::string model_folder, asset_folder;
+    bool multi = false;
+    int n_vocab = -1;
+    std::vector<int> lengths{16, 32, 64, 128};
+    std::vector<int> thread_counts{1, 2, 4};
+    int runs = 10, warmup = 2;
+    int sampling_rate = 22050;
+    bool check = false;
+    bool mmap_weights = true;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--multi") multi = true;
+        else if (arg == "--check") check = true;
+        else if (arg == "--no-mmap") mmap_weights = false;
+        else if (arg == "--model" && has_value) model_folder = argv[++i];
+        else if (arg == "--assets" && has_value) asset_folder = argv[++i];
+        else if (arg == "--n_vocab" && has_value) n_vocab = atoi(argv[++i]);
+        else if (arg == "--lengths" && has_value) lengths = parse_list(argv[++i]);
+        else if (arg == "--threads" && has_value) thread_counts = parse_list(argv[++i]);
+        else if (arg == "--runs" && has_value) runs = std::max(atoi(argv[++i]), 1);
+        else if (arg == "--warmup" && has_value) warmup = std::max(atoi(argv[++i]), 0);
+        else if (arg == "--sampling_rate" && has_value) sampling_rate = atoi(argv[++i]);
+        else {
+            fprintf(stderr, "unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    CountingAllocator blob_allocator;
+    CountingAllocator workspace_allocator;
+    Option opt;
+    opt.lightmode = true;
+    opt.use_packing_layout = true;
+    opt.blob_allocator = &blob_allocator;
+    opt.workspace_allocator = &workspace_allocator;
+
+    if (check) {
+        opt.num_threads = thread_counts.empty() ? 1 : thread_counts.back();
+        if (!run_checks(lengths, opt)) return 1;
+    }
+
+    AAssetManager assets(asset_folder);
+    SynthesizerTrn net_g;
+    bool with_model = !model_folder.empty();
+    double load_start = get_current_time();
+    // init only checks the files, load() brings in every net forward runs
+    if (with_model && (!net_g.init(model_folder, false, multi, n_vocab, &assets, opt, mmap_weights)
+                       || !net_g.load(false)))
+        return 1;
+    double load_time = get_current_time() - load_start;
+    if (with_model && check && multi && !run_speaker_checks(net_g, opt)) return 1;
+    if (with_model && check && !run_pack_checks(net_g, multi, n_vocab, opt)) return 1;
+    if (with_model) {
+        for (const NetLoadReport &report: net_g.load_report())
+            fprintf(stderr, "load %-14s %8.1f ms %8zu KB\n", report.name.c_str(), report.load_ms,
+                    report.bytes / 1024);
+    }
+
+    std::vector<BenchResult> results;
+    auto add_result = [&](const std::string &stage, int length, int threads,
+                          const std::vector<double> &times, double audio_seconds) {
+        size_t peak = blob_allocator.peak_bytes() + workspace_allocator.peak_bytes();
+        double p50 = percentile(times, 0.5);
+        results.push_back({stage, length, threads, p50, percentile(times, 0.95),
+                           audio_seconds > 0 ? p50 / 1000.0 / audio_seconds : 0, peak});
+        blob_allocator.reset_peak();
+        workspace_allocator.reset_peak();
+    };
+
+    if (with_model) add_result("load", 0, opt.num_threads, {load_time}, 0);
+
+    for (int threads: thread_counts) {
+        opt.num_threads = threads;
+        for (int length: lengths) {
+            int t_x = length;
+            int t_y = length * FRAMES_PER_TOKEN;
+            double audio_seconds = double(t_y) * HOP_LENGTH / sampling_rate;
+
+            // helpers, shaped like the tensors of forward / voice_convert
+            Mat attn = filled(t_x, t_y, 1.f / t_x);
+            Mat m_p_t = randn(HIDDEN_CHANNELS, t_x, opt);
+            auto times = measure(runs, warmup, [&]() { matmul(attn, m_p_t, opt); });
+            add_result("matmul", length, threads, times, audio_seconds);
+
+            Mat z_p = randn(t_y, HIDDEN_CHANNELS, opt);
+            times = measure(runs, warmup, [&]() { mattranspose(z_p, opt); });
+            add_result("mattranspose", length, threads, times, audio_seconds);
+
+            Mat w_ceil = filled(t_x, 1, float(FRAMES_PER_TOKEN));
+            Mat attn_mask = filled(t_x, t_y, 1.f);
+            times = measure(runs, warmup, [&]() { generate_path(w_ceil, attn_mask, opt); });
+            add_result("generate_path", length, threads, times, audio_seconds);
+
+            Mat m_p = randn(t_x, HIDDEN_CHANNELS, opt);
+            times = measure(runs, warmup, [&]() { expand_by_duration(m_p, w_ceil, t_y, opt); });
+            add_result("expand_by_duration", length, threads, times, audio_seconds);
+
+            Mat audio = randn(t_y * HOP_LENGTH, 1, opt);
+            times = measure(runs, warmup, [&]() { stft(audio, 1024, HOP_LENGTH, 1024, opt); });
+            add_result("stft", length, threads, times, audio_seconds);
+
+            times = measure(runs, warmup, [&]() {
+                stft_magnitude(audio, 1024, HOP_LENGTH, 1024, opt);
+            });
+            add_result("stft_magnitude", length, threads, times, audio_seconds);
+
+            times = measure(runs, warmup, [&]() { randn(t_y, HIDDEN_CHANNELS, opt); });
+            add_result("randn", length, threads, times, audio_seconds);
+
+            if (!with_model) continue;
+
+            // whole pipeline, split by stage
+            Mat tokens(t_x, 1);
+            float *p = tokens;
+            int vocab = n_vocab > 1 ? n_vocab : 2;
+            for (int i = 0; i < t_x; i++) p[i] = float(i % 2 == 0 ? 0 : 1 + i % (vocab - 1));
+
+            std::vector<double> enc_p, dp, align, flow_reverse, dec, total;
+            double seconds = 0;
+            for (int i = 0; i < warmup + runs; i++) {
+                SynthesisProfile profile;
+                double start = get_current_time();
+                Mat o = net_g.forward(tokens, opt, false, multi, 0, .667f, 0.8f, 1.f, 0, &profile);
+                double elapsed = get_current_time() - start;
+                if (i < warmup) continue;
+                enc_p.push_back(profile.enc_p);
+                dp.push_back(profile.dp);
+                align.push_back(profile.align);
+                flow_reverse.push_back(profile.flow_reverse);
+                dec.push_back(profile.dec);
+                total.push_back(elapsed);
+                seconds = double(o.w) * o.h / sampling_rate;
+            }
+            add_result("enc_p", length, threads, enc_p, seconds);
+            add_result("dp", length, threads, dp, seconds);
+            add_result("align", length, threads, align, seconds);
+            add_result("flow.reverse", length, threads, flow_reverse, seconds);
+            add_result("dec", length, threads, dec, seconds);
+            add_result("forward", length, threads, total, seconds);
+
+            // a reply split into four sentences of this length, front stages one by one and
+            // packed into one pass, --check compares their latents
+            std::vector<Mat> sentences(4, tokens);
+            std::vector<Mat> z_ps, y_masks;
+            Mat z_p_single, y_mask_single, g;
+            times = measure(runs, warmup, [&]() {
+                for (const Mat &x: sentences) {
+                    net_g.prepare_latent(x, opt, false, multi, 0, .667f, 0.8f, 1.f, 0,
+                                         z_p_single, y_mask_single, g);
+                }
+            });
+            add_result("prepare_latent x4", length, threads, times, seconds * 4);
+            times = measure(runs, warmup, [&]() {
+                net_g.prepare_latents(sentences, opt, false, multi, 0, .667f, 0.8f, 1.f, 0, z_ps,
+                                      y_masks, g);
+            });
+            add_result("prepare_latents x4", length, threads, times, seconds * 4);
+        }
+    }
+
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\n  \"runs\": %d,\n  \"max_rss_kb\": %ld,\n  \"results\": [\n", runs,
+           usage.ru_maxrss);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        printf("    {\"stage\": \"%s\", \"length\": %d, \"threads\": %d, \"p50_ms\": %.3f, "
+               "\"p95_ms\": %.3f, \"rtf\": %.4f, \"peak_alloc_bytes\": %zu}%s\n",
+               r.stage.c_str(), r.length, r.threads, r.p50, r.p95, r.rtf, r.peak_bytes,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+// command line front end of the host build
+//
+// vits_cli --model <folder> --assets <folder> --ids 0,23,0,41,0 -o out.wav
+// vits_cli --model <folder> --assets <folder> --symbols symbols.txt --text こんにちは -o out.wav
+//
+// --model    folder holding *.ncnn.bin and emb_t.bin / emb_g.bin, with trailing '/'
+// --assets   VITS/src/main/assets, provides {single,multi}/*.ncnn.param and the openjtalk dictionary
+// --symbols  the model config's symbols list, one symbol per line, only needed for --text
+#include "SynthesizerTrn.h"
+#include "text_input.h"
+#include "../wave_utils/wave.h"
+
+static void usage() {
+    fprintf(stderr,
+            "usage: vits_cli --model <folder> --assets <folder> (--ids <i,j,...> | --text <text> "
+            "--symbols <file>) [-o out.wav]\n"
+            "       [--multi] [--sid n] [--noise_scale f] [--noise_scale_w f] "
+            "[--length_scale f]\n"
+            "       [--seed n] [--threads n] [--sampling_rate n]\n");
+}
+
+int main(int argc, char **argv) {
+    std::string model_folder, asset_folder, ids_arg, text, symbols_path;
+    std::string output = "out.wav";
+    bool multi = false;
+    int sid = 0;
+    float noise_scale = .667f, noise_scale_w = 0.8f, length_scale = 1.f;
+    int64_t seed = -1;
+    int num_threads = get_big_cpu_count();
+    int sampling_rate = 22050;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--multi") multi = true;
+        else if (arg == "--model" && has_value) model_folder = argv[++i];
+        else if (arg == "--assets" && has_value) asset_folder = argv[++i];
+        else if (arg == "--ids" && has_value) ids_arg = argv[++i];
+        else if (arg == "--text" && has_value) text = argv[++i];
+        else if (arg == "--symbols" && has_value) symbols_path = argv[++i];
+        else if (arg == "-o" && has_value) output = argv[++i];
+        else if (arg == "--sid" && has_value) sid = atoi(argv[++i]);
+        else if (arg == "--noise_scale" && has_value) noise_scale = float(atof(argv[++i]));
+        else if (arg == "--noise_scale_w" && has_value) noise_scale_w = float(atof(argv[++i]));
+        else if (arg == "--length_scale" && has_value) length_scale = float(atof(argv[++i]));
+        else if (arg == "--seed" && has_value) seed = atoll(argv[++i]);
+        else if (arg == "--threads" && has_value) num_threads = atoi(argv[++i]);
+        else if (arg == "--sampling_rate" && has_value) sampling_rate = atoi(argv[++i]);
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (model_folder.empty() || asset_folder.empty() || (ids_arg.empty() && text.empty())) {
+        usage();
+        return 1;
+    }
+
+    AAssetManager assets(asset_folder);
+
+    std::vector<int> ids;
+    int n_vocab = -1;
+    if (!text.empty()) {
+        auto symbols = load_symbols(symbols_path);
+        if (symbols.empty()) {
+            LOGE("--text needs a non-empty --symbols file");
+            return 1;
+        }
+        n_vocab = int(symbols.size());
+        OpenJtalk openJtalk;
+        AssetJNI assetJni(&assets);
+        if (!openJtalk.init("open_jtalk_dic_utf_8-1.11", &assetJni)) return 1;
+        std::string cleaned = japanese_cleaners(openJtalk, text);
+        LOGI("cleaned text: %s", cleaned.c_str());
+        ids = text_to_ids(cleaned, symbols);
+    } else {
+        ids = parse_ids(ids_arg);
+    }
+    if (ids.empty()) {
+        LOGE("no input ids");
+        return 1;
+    }
+
+    Option opt;
+    opt.lightmode = true;
+    opt.use_packing_layout = true;
+    opt.num_threads = num_threads;
+
+    SynthesizerTrn net_g;
+    if (!net_g.init(model_folder, false, multi, n_vocab, &assets, opt)) return 1;
+
+    Mat data((int) ids.size(), 1);
+    float *p = data;
+    for (size_t i = 0; i < ids.size(); i++) p[i] = (float) ids[i];
+
+    auto start = get_current_time();
+    Mat audio = net_g.forward(data, opt, false, multi, sid, noise_scale, noise_scale_w,
+                              length_scale, seed);
+    auto end = get_current_time();
+    if (audio.empty()) return 1;
+    size_t length = size_t(audio.w) * audio.h;
+    LOGI("time cost: %f ms, %.2f s of audio", end - start, float(length) / sampling_rate);
+
+    FILE *fp = fopen(output.c_str(), "wb");
+    if (fp == nullptr) {
+        LOGE("cannot write %s", output.c_str());
+        return 1;
+    }
+    char header[WAV_HEADER_SIZE];
+    WriteWavHeader(header, length, sampling_rate);
+    fwrite(header, 1, WAV_HEADER_SIZE, fp);
+    fwrite((const float *) audio, sizeof(float), length, fp);
+    fclose(fp);
+    return 0;
+}
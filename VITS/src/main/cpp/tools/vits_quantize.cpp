@@ -0,0 +1,353 @@
+// writes fp16 / int8 weight variants of the speech nets and compares them with fp32, prints one
+// JSON document on stdout
+//
+// vits_quantize --model <folder> --assets <folder> [--multi] [--n_vocab n]
+//               [--format fp16|int8] [--samples <file> [--symbols <file>]] [--max_distance d]
+//               [--seed n] [--threads n] [--runs 3] [--sampling_rate 22050] [--no-mmap]
+//
+// --format        writes <net>.<format>.ncnn.bin next to the fp32 weights of enc_p, dp,
+//                 flow.reverse and dec, without it only the formats already there are compared
+// --samples       inputs to calibrate and compare on, one per line: comma separated ids, or text
+//                 when --symbols is given. Without it a synthetic sentence of 64 tokens is used
+// --max_distance  int8 calibration: the nets are quantized one at a time, largest first, and a
+//                 net that takes the mean mel distance of the samples above d dB stays fp16
+//
+// for every format present the report holds the bytes of weights loaded, the load time, the
+// forward p50 over all samples and the log-mel distance to fp32, DTW aligned since quantized
+// duration predictors may move phoneme boundaries by a frame
+#include <cmath>
+#include <unistd.h>
+#include "SynthesizerTrn.h"
+#include "text_input.h"
+
+#define N_FFT 1024
+#define HOP_LENGTH 256
+#define N_MELS 80
+
+// largest first, so calibration spends the distance budget where it saves the most
+static const char *quantized_nets[] = {"dec", "flow.reverse", "enc_p", "dp"};
+
+struct FormatResult {
+    WeightFormat format;
+    size_t weight_bytes;
+    double load_ms;
+    double p50;
+    double rtf;
+    double distance;
+};
+
+static void usage() {
+    fprintf(stderr,
+            "usage: vits_quantize --model <folder> --assets <folder> [--multi] [--n_vocab n]\n"
+            "       [--format fp16|int8] [--samples <file> [--symbols <file>]] "
+            "[--max_distance d]\n"
+            "       [--seed n] [--threads n] [--runs n] [--sampling_rate n] [--no-mmap]\n");
+}
+
+static Mat ids_to_mat(const std::vector<int> &ids) {
+    Mat data((int) ids.size(), 1);
+    float *p = data;
+    for (size_t i = 0; i < ids.size(); i++) p[i] = (float) ids[i];
+    return data;
+}
+
+static std::vector<Mat> load_samples(const std::string &path, const std::string &symbols_path,
+                                     AAssetManager &assets, int &n_vocab) {
+    std::vector<Mat> samples;
+    std::ifstream in(path);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) lines.push_back(line);
+    }
+    if (symbols_path.empty()) {
+        for (const std::string &l: lines) samples.push_back(ids_to_mat(parse_ids(l)));
+        return samples;
+    }
+    auto symbols = load_symbols(symbols_path);
+    if (symbols.empty()) return samples;
+    n_vocab = int(symbols.size());
+    OpenJtalk openJtalk;
+    AssetJNI assetJni(&assets);
+    if (!openJtalk.init("open_jtalk_dic_utf_8-1.11", &assetJni)) return samples;
+    for (const std::string &l: lines) {
+        std::vector<int> ids = text_to_ids(japanese_cleaners(openJtalk, l), symbols);
+        if (ids.size() > 1) samples.push_back(ids_to_mat(ids));
+    }
+    return samples;
+}
+
+// triangular filters on the HTK mel scale, N_MELS rows of N_FFT / 2 + 1 bins
+static std::vector<float> mel_filters(int sampling_rate) {
+    const int bins = N_FFT / 2 + 1;
+    auto hz_to_mel = [](double hz) { return 2595.0 * std::log10(1.0 + hz / 700.0); };
+    auto mel_to_hz = [](double mel) { return 700.0 * (std::pow(10.0, mel / 2595.0) - 1.0); };
+    double mel_max = hz_to_mel(sampling_rate / 2.0);
+    std::vector<double> edges(N_MELS + 2);
+    for (int m = 0; m < N_MELS + 2; m++) edges[m] = mel_to_hz(mel_max * m / (N_MELS + 1));
+
+    std::vector<float> filters(size_t(N_MELS) * bins, 0.f);
+    for (int m = 0; m < N_MELS; m++) {
+        for (int k = 0; k < bins; k++) {
+            double hz = double(k) * sampling_rate / N_FFT;
+            double up = (hz - edges[m]) / (edges[m + 1] - edges[m]);
+            double down = (edges[m + 2] - hz) / (edges[m + 2] - edges[m + 1]);
+            filters[size_t(m) * bins + k] = float(std::max(0.0, std::min(up, down)));
+        }
+    }
+    return filters;
+}
+
+// (frames x N_MELS) log-mel spectrogram in dB
+static std::vector<float> log_mel(const Mat &audio, const std::vector<float> &filters,
+                                  const Option &opt, int &frames) {
+    Mat spec = stft_magnitude(audio, N_FFT, HOP_LENGTH, N_FFT, opt);
+    frames = spec.w;
+    const int bins = N_FFT / 2 + 1;
+    std::vector<float> mel(size_t(frames) * N_MELS);
+    for (int f = 0; f < frames; f++) {
+        for (int m = 0; m < N_MELS; m++) {
+            const float *filter = &filters[size_t(m) * bins];
+            float sum = 0;
+            for (int k = 0; k < bins; k++) sum += filter[k] * spec.row(k)[f];
+            mel[size_t(f) * N_MELS + m] = 20.f * std::log10(std::max(sum, 1e-5f));
+        }
+    }
+    return mel;
+}
+
+// mean absolute log-mel difference along the cheapest monotonic alignment of the frames
+static double mel_distance(const std::vector<float> &a, int na, const std::vector<float> &b,
+                           int nb) {
+    if (na == 0 || nb == 0) return na == nb ? 0 : INFINITY;
+    auto frame_cost = [&](int i, int j) {
+        const float *pa = &a[size_t(i) * N_MELS];
+        const float *pb = &b[size_t(j) * N_MELS];
+        double sum = 0;
+        for (int m = 0; m < N_MELS; m++) sum += std::fabs(pa[m] - pb[m]);
+        return sum / N_MELS;
+    };
+    // cost and length of the best path to each cell, two rows at a time
+    std::vector<double> cost(nb), prev_cost(nb);
+    std::vector<int> steps(nb), prev_steps(nb);
+    for (int i = 0; i < na; i++) {
+        for (int j = 0; j < nb; j++) {
+            double best = 0;
+            int best_steps = 0;
+            if (i > 0 || j > 0) {
+                best = INFINITY;
+                if (i > 0 && prev_cost[j] < best) {
+                    best = prev_cost[j];
+                    best_steps = prev_steps[j];
+                }
+                if (j > 0 && cost[j - 1] < best) {
+                    best = cost[j - 1];
+                    best_steps = steps[j - 1];
+                }
+                if (i > 0 && j > 0 && prev_cost[j - 1] < best) {
+                    best = prev_cost[j - 1];
+                    best_steps = prev_steps[j - 1];
+                }
+            }
+            cost[j] = best + frame_cost(i, j);
+            steps[j] = best_steps + 1;
+        }
+        cost.swap(prev_cost);
+        steps.swap(prev_steps);
+    }
+    return prev_cost[nb - 1] / prev_steps[nb - 1];
+}
+
+struct MelSet {
+    std::vector<std::vector<float>> mels;
+    std::vector<int> frames;
+};
+
+// synthesizes every sample runs times with weights in format, fills result and the mel of the
+// outputs; distance is left to the caller
+static bool run_format(const std::string &model_folder, AAssetManager &assets, bool multi,
+                       int n_vocab, WeightFormat format, bool mmap_weights, Option &opt,
+                       const std::vector<Mat> &samples, int64_t seed, int runs, int sampling_rate,
+                       const std::vector<float> &filters, FormatResult &result, MelSet &mels) {
+    SynthesizerTrn net_g;
+    double load_start = get_current_time();
+    if (!net_g.init(model_folder, false, multi, n_vocab, &assets, opt, mmap_weights, format) ||
+        !net_g.load(false))
+        return false;
+    result.format = format;
+    result.load_ms = get_current_time() - load_start;
+    result.weight_bytes = 0;
+    for (const NetLoadReport &report: net_g.load_report()) result.weight_bytes += report.bytes;
+
+    std::vector<double> times;
+    double seconds = 0;
+    mels.mels.clear();
+    mels.frames.clear();
+    for (const Mat &x: samples) {
+        Mat o;
+        for (int i = 0; i < runs; i++) {
+            double start = get_current_time();
+            o = net_g.forward(x, opt, false, multi, 0, .667f, 0.8f, 1.f, seed);
+            times.push_back(get_current_time() - start);
+        }
+        if (o.empty()) return false;
+        seconds += double(o.w) * o.h / sampling_rate;
+        int frames = 0;
+        mels.mels.push_back(log_mel(o, filters, opt, frames));
+        mels.frames.push_back(frames);
+    }
+    std::sort(times.begin(), times.end());
+    result.p50 = times[times.size() / 2];
+    result.rtf = seconds > 0 ? std::accumulate(times.begin(), times.end(), 0.0) / runs / 1000.0 /
+                               seconds : 0;
+    return true;
+}
+
+static double mean_distance(const MelSet &reference, const MelSet &mels) {
+    double sum = 0;
+    for (size_t i = 0; i < reference.mels.size(); i++) {
+        sum += mel_distance(reference.mels[i], reference.frames[i], mels.mels[i], mels.frames[i]);
+    }
+    return reference.mels.empty() ? 0 : sum / reference.mels.size();
+}
+
+// the fp32 weights of net name in format, written to the file of file_format
+static bool convert_net(const std::string &model_folder, AAssetManager &assets, bool multi,
+                        const std::string &name, WeightFormat format, WeightFormat file_format) {
+    Net net;
+    if (!SynthesizerTrn::load_param(net, name, multi, &assets)) {
+        LOGE("param of %s load fail", name.c_str());
+        return false;
+    }
+    return convert_weights(net, weight_file(model_folder, name, WEIGHTS_FP32),
+                           weight_file(model_folder, name, file_format), format);
+}
+
+int main(int argc, char **argv) {
+    std::string model_folder, asset_folder, format_arg, samples_path, symbols_path;
+    bool multi = false;
+    bool mmap_weights = true;
+    int n_vocab = -1;
+    float max_distance = 1.5f;
+    int64_t seed = 0;
+    int num_threads = get_big_cpu_count();
+    int runs = 3;
+    int sampling_rate = 22050;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--multi") multi = true;
+        else if (arg == "--no-mmap") mmap_weights = false;
+        else if (arg == "--model" && has_value) model_folder = argv[++i];
+        else if (arg == "--assets" && has_value) asset_folder = argv[++i];
+        else if (arg == "--n_vocab" && has_value) n_vocab = atoi(argv[++i]);
+        else if (arg == "--format" && has_value) format_arg = argv[++i];
+        else if (arg == "--samples" && has_value) samples_path = argv[++i];
+        else if (arg == "--symbols" && has_value) symbols_path = argv[++i];
+        else if (arg == "--max_distance" && has_value) max_distance = float(atof(argv[++i]));
+        else if (arg == "--seed" && has_value) seed = atoll(argv[++i]);
+        else if (arg == "--threads" && has_value) num_threads = atoi(argv[++i]);
+        else if (arg == "--runs" && has_value) runs = std::max(1, atoi(argv[++i]));
+        else if (arg == "--sampling_rate" && has_value) sampling_rate = atoi(argv[++i]);
+        else {
+            usage();
+            return 1;
+        }
+    }
+    WeightFormat format = WEIGHTS_FP32;
+    if (format_arg == "fp16") format = WEIGHTS_FP16;
+    else if (format_arg == "int8") format = WEIGHTS_INT8;
+    else if (!format_arg.empty()) {
+        usage();
+        return 1;
+    }
+    if (model_folder.empty() || asset_folder.empty()) {
+        usage();
+        return 1;
+    }
+    // a negative seed would give every run different noise and the distances would measure it
+    seed = std::max<int64_t>(seed, 0);
+
+    AAssetManager assets(asset_folder);
+    std::vector<Mat> samples;
+    if (!samples_path.empty()) {
+        samples = load_samples(samples_path, symbols_path, assets, n_vocab);
+        if (samples.empty()) {
+            LOGE("no samples in %s", samples_path.c_str());
+            return 1;
+        }
+    } else {
+        std::vector<int> ids(64);
+        int vocab = n_vocab > 1 ? n_vocab : 2;
+        for (int i = 0; i < 64; i++) ids[i] = i % 2 == 0 ? 0 : 1 + i % (vocab - 1);
+        samples.push_back(ids_to_mat(ids));
+    }
+
+    Option opt;
+    opt.lightmode = true;
+    opt.use_packing_layout = true;
+    opt.num_threads = num_threads;
+
+    std::vector<float> filters = mel_filters(sampling_rate);
+    MelSet reference, mels;
+    std::vector<FormatResult> results(1);
+    if (!run_format(model_folder, assets, multi, n_vocab, WEIGHTS_FP32, mmap_weights, opt,
+                    samples, seed, runs, sampling_rate, filters, results[0], reference))
+        return 1;
+    results[0].distance = 0;
+
+    if (format == WEIGHTS_FP16) {
+        for (const char *name: quantized_nets) {
+            if (!convert_net(model_folder, assets, multi, name, WEIGHTS_FP16, WEIGHTS_FP16))
+                return 1;
+        }
+    } else if (format == WEIGHTS_INT8) {
+        // nets without an int8 file load fp32, so each step measures the nets kept so far plus
+        // the one being tried
+        for (const char *name: quantized_nets)
+            remove(weight_file(model_folder, name, WEIGHTS_INT8).c_str());
+        for (const char *name: quantized_nets) {
+            if (!convert_net(model_folder, assets, multi, name, WEIGHTS_INT8, WEIGHTS_INT8))
+                return 1;
+            FormatResult trial{};
+            if (!run_format(model_folder, assets, multi, n_vocab, WEIGHTS_INT8, mmap_weights, opt,
+                            samples, seed, 1, sampling_rate, filters, trial, mels))
+                return 1;
+            double distance = mean_distance(reference, mels);
+            bool keep = distance <= max_distance;
+            fprintf(stderr, "int8 %-14s mel distance %.3f dB, %s\n", name, distance,
+                    keep ? "kept" : "stored as fp16");
+            // fp16 tensors are valid in the int8 file, ncnn reads the format of each tensor
+            if (!keep &&
+                !convert_net(model_folder, assets, multi, name, WEIGHTS_FP16, WEIGHTS_INT8))
+                return 1;
+        }
+    }
+
+    for (WeightFormat variant: {WEIGHTS_FP16, WEIGHTS_INT8}) {
+        bool present = false;
+        for (const char *name: quantized_nets) {
+            present |= access(weight_file(model_folder, name, variant).c_str(), R_OK) == 0;
+        }
+        if (!present) continue;
+        FormatResult result{};
+        if (!run_format(model_folder, assets, multi, n_vocab, variant, mmap_weights, opt, samples,
+                        seed, runs, sampling_rate, filters, result, mels))
+            return 1;
+        result.distance = mean_distance(reference, mels);
+        results.push_back(result);
+    }
+
+    printf("{\n  \"samples\": %zu,\n  \"runs\": %d,\n  \"results\": [\n", samples.size(), runs);
+    for (size_t i = 0; i < results.size(); i++) {
+        const FormatResult &r = results[i];
+        printf("    {\"format\": \"%s\", \"weight_bytes\": %zu, \"load_ms\": %.3f, "
+               "\"p50_ms\": %.3f, \"rtf\": %.4f, \"mel_distance_db\": %.4f}%s\n",
+               weight_format_name(r.format), r.weight_bytes, r.load_ms, r.p50, r.rtf, r.distance,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
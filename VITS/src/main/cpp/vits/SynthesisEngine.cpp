@@ -0,0 +1,274 @@
+#include "SynthesisEngine.h"
+#include <thread>
+#include "pipeline.h"
+
+// returns its context to the engine when the request ends, however it ends
+class SynthesisEngine::ContextLease {
+private:
+    SynthesisEngine &engine;
+
+public:
+    Context *const context;
+
+    explicit ContextLease(SynthesisEngine &engine)
+            : engine(engine), context(engine.acquire_context()) {}
+
+    ~ContextLease() { engine.release_context(context); }
+};
+
+SynthesisEngine::SynthesisEngine() {
+    opt.lightmode = true;
+    opt.use_packing_layout = true;
+    opt.num_threads = get_big_cpu_count();
+}
+
+bool SynthesisEngine::init(const std::string &model_folder, bool voice_convert, bool multi_,
+                           int n_vocab, AAssetManager *assetManager,
+                           WeightFormat weight_format) {
+    multi = multi_;
+    voice_convert_model = voice_convert;
+    // audio of a model this engine held before, spilled entries stay for when it comes back
+    cache.clear();
+#if NCNN_VULKAN
+    // use vulkan compute
+    if (ncnn::get_gpu_count() != 0)
+        opt.use_vulkan_compute = true;
+#endif
+    // pipelines are created once per net as it loads, the allocators of each request are set on
+    // its extractors
+    if (!net_g.init(model_folder, voice_convert, multi, n_vocab, assetManager, opt, true,
+                    weight_format))
+        return false;
+    // the first request only waits for whatever the prefetch has not loaded yet
+    net_g.prefetch(voice_convert);
+    return true;
+}
+
+SynthesisEngine::Context *SynthesisEngine::acquire_context() {
+    std::lock_guard<std::mutex> guard(contexts_lock);
+    if (!idle_contexts.empty()) {
+        Context *context = idle_contexts.back();
+        idle_contexts.pop_back();
+        return context;
+    }
+    contexts.emplace_back(new Context());
+    return contexts.back().get();
+}
+
+void SynthesisEngine::release_context(Context *context) {
+    context->blob_allocator.reset();
+    std::lock_guard<std::mutex> guard(contexts_lock);
+    idle_contexts.push_back(context);
+}
+
+Option SynthesisEngine::request_option(Context *context, int num_threads) const {
+    Option request = opt;
+    if (num_threads > 0) request.num_threads = num_threads;
+    request.blob_allocator = &context->blob_allocator;
+    request.workspace_allocator = &context->workspace_allocator;
+    return request;
+}
+
+// passes every block on to callback and appends it to samples, so the audio of a sentence can
+// be cached once all of it was delivered
+static AudioChunkCallback recording_callback(const AudioChunkCallback &callback,
+                                             std::vector<float> &samples) {
+    return [&callback, &samples](const Mat &audio) {
+        const float *p = audio;
+        samples.insert(samples.end(), p, p + audio.w * audio.h);
+        return callback(audio);
+    };
+}
+
+static Mat samples_to_mat(const std::vector<float> &samples) {
+    Mat audio(int(samples.size()));
+    if (!samples.empty()) memcpy(audio, samples.data(), samples.size() * sizeof(float));
+    return audio;
+}
+
+Mat SynthesisEngine::forward(const Mat &x, int num_threads, bool vulkan, int sid,
+                             float noise_scale, float noise_scale_w, float length_scale,
+                             int64_t seed, SynthesisProfile *profile) {
+    if (voice_convert_model) return {};
+    std::string key = SynthesisCache::make_key(net_g.fingerprint(), x, sid, noise_scale,
+                                               noise_scale_w, length_scale, seed, 0);
+    Mat cached = cache.find(key);
+    if (!cached.empty()) return cached;
+
+    ContextLease lease(*this);
+    Option request = request_option(lease.context, num_threads);
+    // the result is cloned out of the pool, the next request on this context reuses the memory
+    Mat out = net_g.forward(x, request, vulkan, multi, sid, noise_scale, noise_scale_w,
+                            length_scale, seed, profile).clone();
+    cache.insert(key, out);
+    return out;
+}
+
+bool SynthesisEngine::forward_stream(const Mat &x, const AudioChunkCallback &callback,
+                                     int num_threads, bool vulkan, int sid, float noise_scale,
+                                     float noise_scale_w, float length_scale, int64_t seed,
+                                     int chunk_frames) {
+    if (voice_convert_model) return false;
+    std::string key = SynthesisCache::make_key(net_g.fingerprint(), x, sid, noise_scale,
+                                               noise_scale_w, length_scale, seed, chunk_frames);
+    // a cached sentence arrives as one block
+    Mat cached = cache.find(key);
+    if (!cached.empty()) return callback(cached);
+
+    ContextLease lease(*this);
+    Option request = request_option(lease.context, num_threads);
+    if (key.empty()) {
+        return net_g.forward_stream(x, callback, request, vulkan, multi, sid, noise_scale,
+                                    noise_scale_w, length_scale, seed, chunk_frames);
+    }
+    std::vector<float> samples;
+    if (!net_g.forward_stream(x, recording_callback(callback, samples), request, vulkan, multi,
+                              sid, noise_scale, noise_scale_w, length_scale, seed, chunk_frames))
+        return false;
+    cache.insert(key, samples_to_mat(samples));
+    return true;
+}
+
+// token budget of one packed enc_p / dp pass, attention over the batch grows quadratically
+static const int batch_tokens = 256;
+
+// output of the front stages for one sentence, empty z_p when they failed, or its cached audio
+struct PreparedSentence {
+    size_t index;
+    Mat z_p;
+    Mat y_mask;
+    Mat g;
+    Mat audio;
+};
+
+bool SynthesisEngine::forward_sentences(const std::vector<Mat> &sentences,
+                                        const AudioChunkCallback &callback, int num_threads,
+                                        bool vulkan, int sid, float noise_scale,
+                                        float noise_scale_w, float length_scale, int64_t seed,
+                                        int chunk_frames, int queue_depth) {
+    if (voice_convert_model) return false;
+    if (sentences.empty()) return true;
+    if (num_threads <= 0) num_threads = opt.num_threads;
+
+    // enc_p / dp are a small share of the work, on big.LITTLE they get the little cores and the
+    // decoder keeps the big ones, elsewhere the threads are split between the two stages
+    int little_cpus = get_little_cpu_count();
+    bool core_groups = little_cpus > 0 && little_cpus < get_cpu_count();
+    int front_threads = core_groups ? little_cpus : std::max(1, num_threads / 4);
+    int back_threads = core_groups ? num_threads : std::max(1, num_threads - front_threads);
+
+    // each stage allocates from its own pools, they are not shared between threads
+    ContextLease front_lease(*this);
+    ContextLease back_lease(*this);
+    Option front_opt = request_option(front_lease.context, front_threads);
+    Option back_opt = request_option(back_lease.context, back_threads);
+
+    // cached sentences skip both stages
+    std::vector<std::string> keys(sentences.size());
+    std::vector<Mat> cached(sentences.size());
+    for (size_t i = 0; i < sentences.size(); i++) {
+        // decoded in windows like forward_stream, which shares these entries
+        keys[i] = SynthesisCache::make_key(net_g.fingerprint(), sentences[i], sid, noise_scale,
+                                           noise_scale_w, length_scale, seed, chunk_frames);
+        cached[i] = cache.find(keys[i]);
+    }
+
+    BoundedQueue<PreparedSentence> queue(size_t(std::max(queue_depth, 1)));
+    std::thread front([&] {
+        if (core_groups) set_cpu_thread_affinity(get_cpu_thread_affinity_mask(1));
+        // the first sentence goes alone so its audio starts early, the rest are packed into
+        // batches of up to batch_tokens tokens for one enc_p / dp pass each
+        size_t next = 0;
+        bool first = true;
+        bool stopped = false;
+        while (next < sentences.size() && !stopped) {
+            if (!cached[next].empty()) {
+                PreparedSentence prepared{next, Mat(), Mat(), Mat(), cached[next]};
+                stopped = !queue.push(prepared);
+                next++;
+                continue;
+            }
+            size_t end = next + 1;
+            if (!first) {
+                int tokens = sentences[next].w;
+                while (end < sentences.size() && cached[end].empty() &&
+                       tokens + sentences[end].w <= batch_tokens) {
+                    tokens += sentences[end].w;
+                    end++;
+                }
+            }
+            std::vector<Mat> batch(sentences.begin() + next, sentences.begin() + end);
+            std::vector<Mat> z_ps, y_masks;
+            Mat g;
+            if (!net_g.prepare_latents(batch, front_opt, vulkan, multi, sid, noise_scale,
+                                       noise_scale_w, length_scale, seed, z_ps, y_masks, g))
+                z_ps.assign(batch.size(), Mat());
+            for (size_t i = 0; i < batch.size(); i++) {
+                // handed over as copies, the decoder thread must not free into the front pools
+                PreparedSentence prepared{next + i, z_ps[i].clone(), y_masks[i].clone(),
+                                          g.clone(), Mat()};
+                // the decoder stopped, nothing more is wanted
+                if (!queue.push(prepared)) {
+                    stopped = true;
+                    break;
+                }
+            }
+            next = end;
+            first = false;
+        }
+        queue.close();
+    });
+
+    // the decoder runs here, its threads keep to the big cores while the front has the little ones
+    if (core_groups) set_cpu_thread_affinity(get_cpu_thread_affinity_mask(2));
+    bool ok = true;
+    PreparedSentence prepared;
+    while (queue.pop(prepared)) {
+        const std::string &key = keys[prepared.index];
+        std::vector<float> samples;
+        if (!prepared.audio.empty()) {
+            ok = callback(prepared.audio);
+        } else if (key.empty()) {
+            ok = net_g.decode_stream(prepared.z_p, prepared.y_mask, prepared.g, callback,
+                                     back_opt, vulkan, chunk_frames);
+        } else {
+            ok = net_g.decode_stream(prepared.z_p, prepared.y_mask, prepared.g,
+                                     recording_callback(callback, samples), back_opt, vulkan,
+                                     chunk_frames);
+            if (ok) cache.insert(key, samples_to_mat(samples));
+        }
+        if (!ok) break;
+        prepared = PreparedSentence();
+    }
+    // unblocks the front stage if it is waiting on a full queue
+    queue.close();
+    front.join();
+    // the caller gets every core back, ncnn has no way to read its previous mask
+    if (core_groups) set_cpu_thread_affinity(get_cpu_thread_affinity_mask(0));
+    return ok;
+}
+
+Mat SynthesisEngine::voice_convert(const Mat &x, int raw_sid, int target_sid, int num_threads,
+                                   bool vulkan, int64_t seed) {
+    if (!voice_convert_model) return {};
+    ContextLease lease(*this);
+    Option request = request_option(lease.context, num_threads);
+    Mat out = net_g.voice_convert(x, raw_sid, target_sid, request, vulkan, seed);
+    return out.clone();
+}
+
+void SynthesisEngine::configure_cache(size_t budget_bytes, const std::string &spill_folder,
+                                      size_t spill_budget_bytes) {
+    cache.configure(budget_bytes, spill_folder, spill_budget_bytes);
+}
+
+void SynthesisEngine::trim() {
+    cache.clear();
+    std::lock_guard<std::mutex> guard(contexts_lock);
+    for (Context *context: idle_contexts) {
+        context->blob_allocator.clear();
+        context->workspace_allocator.clear();
+    }
+}
+
+SynthesisEngine::~SynthesisEngine() = default;
@@ -0,0 +1,89 @@
+#ifndef SYNTHESISENGINE_H
+#define SYNTHESISENGINE_H
+
+#include <memory>
+#include <mutex>
+#include "SynthesizerTrn.h"
+#include "arena.h"
+#include "synthesis_cache.h"
+
+// one loaded model with everything a request needs, engines share no state so several of them
+// (one per character) can be resident and synthesize at the same time. Requests on the same
+// engine may also run concurrently: each borrows its own pair of pool allocators and builds its
+// own Option, the nets themselves are only read
+class SynthesisEngine {
+private:
+    // allocators of one in-flight request, kept warm for the next one: the net blobs and every
+    // helper Mat come from the arena, layer scratch from the workspace pool
+    struct Context {
+        ArenaAllocator blob_allocator;
+        PoolAllocator workspace_allocator;
+    };
+
+    class ContextLease;
+
+    SynthesizerTrn net_g;
+    Option opt;
+    bool multi = false;
+    bool voice_convert_model = false;
+
+    std::mutex contexts_lock;
+    std::vector<std::unique_ptr<Context>> contexts;
+    std::vector<Context *> idle_contexts;
+
+    SynthesisCache cache;
+
+    Context *acquire_context();
+
+    void release_context(Context *context);
+
+    Option request_option(Context *context, int num_threads) const;
+
+public:
+    SynthesisEngine();
+
+    bool init(const std::string &model_folder, bool voice_convert, bool multi, int n_vocab,
+              AAssetManager *assetManager, WeightFormat weight_format = WEIGHTS_FP32);
+
+    bool is_multi() const { return multi; }
+
+    // see SynthesizerTrn::load_error
+    std::string load_error() const { return net_g.load_error(); }
+
+    // num_threads <= 0 uses the big cores of the device
+    Mat forward(const Mat &x, int num_threads, bool vulkan = false, int sid = 0,
+                float noise_scale = .667, float noise_scale_w = 0.8, float length_scale = 1,
+                int64_t seed = -1, SynthesisProfile *profile = nullptr);
+
+    bool forward_stream(const Mat &x, const AudioChunkCallback &callback, int num_threads,
+                        bool vulkan = false, int sid = 0, float noise_scale = .667,
+                        float noise_scale_w = 0.8, float length_scale = 1, int64_t seed = -1,
+                        int chunk_frames = 64);
+
+    // streams the audio of several sentences in order, while one sentence is being decoded the
+    // text encoder and duration predictor already run on the following ones, packed into batches,
+    // with at most queue_depth prepared sentences waiting. The front stages take a quarter of the threads, or
+    // the little cores on big.LITTLE devices. Every sentence uses seed, as with forward_stream
+    bool forward_sentences(const std::vector<Mat> &sentences, const AudioChunkCallback &callback,
+                           int num_threads, bool vulkan = false, int sid = 0,
+                           float noise_scale = .667, float noise_scale_w = 0.8,
+                           float length_scale = 1, int64_t seed = -1, int chunk_frames = 64,
+                           int queue_depth = 2);
+
+    Mat voice_convert(const Mat &x, int raw_sid, int target_sid, int num_threads,
+                      bool vulkan = false, int64_t seed = -1);
+
+    // requests with a fixed seed are answered from a cache of budget_bytes when the same tokens
+    // and parameters come again, evicted audio moves to spill_folder up to spill_budget_bytes.
+    // The cache starts with 16 MB in memory and no spill folder
+    void configure_cache(size_t budget_bytes, const std::string &spill_folder,
+                         size_t spill_budget_bytes);
+
+    // drop the pooled memory of idle requests and the cached audio held in memory, the model
+    // stays loaded
+    void trim();
+
+    ~SynthesisEngine();
+};
+
+#endif
@@ -1,6 +1,9 @@
 #include "SynthesizerTrn.h"
 #include "custom_layers.h"
+#include "expr.h"
 #include "../openjtalk/api/api.h"
+#include <sys/stat.h>
+#include <unistd.h>
 
 DEFINE_LAYER_CREATOR(expand_as)
 
@@ -28,9 +31,32 @@ DEFINE_LAYER_CREATOR(ZerosLike)
 
 DEFINE_LAYER_CREATOR(RandnLike)
 
-bool SynthesizerTrn::load_model(const std::string &folder, Net &net, const string &name, bool multi,
-                                const Option &opt, AAssetManager *assetManager) {
-    LOGI("loading %s...\n", name.c_str());
+// the file of format if there is one, nets vits_quantize left out stay fp32
+static std::string net_weight_file(const std::string &folder, const std::string &name,
+                                   WeightFormat format) {
+    std::string path = weight_file(folder, name, format);
+    if (format != WEIGHTS_FP32 && access(path.c_str(), R_OK) != 0)
+        path = weight_file(folder, name, WEIGHTS_FP32);
+    return path;
+}
+
+// extractors run with the caller's threads and allocators rather than those the net was loaded
+// with, so requests holding their own Option can share one set of nets
+static Extractor new_extractor(const Net &net, bool vulkan, const Option &opt) {
+    Extractor ex = net.create_extractor();
+    ex.set_num_threads(opt.num_threads);
+    ex.set_blob_allocator(opt.blob_allocator);
+    ex.set_workspace_allocator(opt.workspace_allocator);
+#if NCNN_VULKAN
+    ex.set_vulkan_compute(vulkan);
+#else
+    (void) vulkan;
+#endif
+    return ex;
+}
+
+bool SynthesizerTrn::load_param(Net &net, const std::string &name, bool multi,
+                                AAssetManager *assetManager) {
     net.register_custom_layer("Tensor.expand_as", expand_as_layer_creator);
     net.register_custom_layer("modules.Transpose", Transpose_layer_creator);
     net.register_custom_layer("Embedding", Embedding_layer_creator);
@@ -45,25 +71,49 @@ bool SynthesizerTrn::load_model(const std::string &folder, Net &net, const strin
     net.register_custom_layer("torch.zeros_like", ZerosLike_layer_creator);
     net.register_custom_layer("modules.RandnLike", RandnLike_layer_creator);
 
-    net.opt = opt;
-    std::string bin_path = join_path(folder, name + ".ncnn.bin");
     std::string param_path;
     if (multi) param_path = "multi/" + name + ".ncnn.param";
     else param_path = "single/" + name + ".ncnn.param";
-    bool param_success = !net.load_param(assetManager, param_path.c_str());
-    bool bin_success = !net.load_model(bin_path.c_str());
-    if (param_success && bin_success) {
+#ifdef __ANDROID__
+    return !net.load_param(assetManager, param_path.c_str());
+#else
+    return !net.load_param(assetManager->path(param_path.c_str()).c_str());
+#endif
+}
+
+bool SynthesizerTrn::load_model(const std::string &folder, Net &net, const string &name) {
+    LOGI("loading %s...\n", name.c_str());
+    std::string bin_path = net_weight_file(folder, name, weight_format);
+    bool bin_success;
+    if (mmap_weights) {
+        // ncnn keeps pointers into the mapping for every weight stored as raw fp32
+        const MappedFile *file = map_file(bin_path);
+        bin_success = file != nullptr && net.load_model(file->data()) > 0;
+    } else {
+        bin_success = !net.load_model(bin_path.c_str());
+    }
+    if (bin_success) {
         LOGI("%s loaded!", name.c_str());
         return true;
     }
-    if (!param_success) LOGE("param load fail");
-    if (!bin_success) LOGE("bin load fail");
+    LOGE("bin load fail");
     return false;
 }
 
 void SynthesizerTrn::clear_nets() {
+    if (prefetch_thread.joinable()) prefetch_thread.join();
+    std::lock_guard<std::mutex> guard(load_lock);
+    parsed_stages = 0;
+    loaded_stages = 0;
+    failed_stages = 0;
+    load_reports.clear();
+
     emb_t.release();
     emb_g.release();
+    {
+        std::lock_guard<std::mutex> speakers_guard(speakers_lock);
+        speakers.clear();
+    }
 
     enc_p.clear();
     enc_q.clear();
@@ -71,6 +121,15 @@ void SynthesizerTrn::clear_nets() {
     flow_reverse.clear();
     flow.clear();
     dp.clear();
+
+    mappings.clear();
+}
+
+const MappedFile *SynthesizerTrn::map_file(const std::string &path) {
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(path)) return nullptr;
+    mappings.push_back(std::move(file));
+    return mappings.back().get();
 }
 
 bool SynthesizerTrn::load_weight(const std::string &folder, Mat &weight, const std::string &name,
@@ -78,18 +137,36 @@ bool SynthesizerTrn::load_weight(const std::string &folder, Mat &weight, const s
                                  const int n) {
     LOGI("loading %s...\n", "text embedding");
     std::string path = join_path(folder, name + ".bin");
+    if (mmap_weights) {
+        const MappedFile *file = map_file(path);
+        if (file != nullptr) {
+            size_t emb_length = file->size() / sizeof(float);
+            if (emb_length % w != 0) return false;
+            int h = int(emb_length / w);
+            if (n != -1 && h != n) return false;
+            // refers to the mapping, read only like every weight
+            weight = Mat(w, h, (void *) file->data());
+            LOGI("text embedding loaded!");
+            return true;
+        }
+        LOGE("text embedding load fail");
+        return false;
+    }
     FILE *fp = fopen(path.c_str(), "rb");
     if (fp != nullptr) {
         fseek(fp, 0, SEEK_END);
         auto file_size = ftell(fp);
         auto emb_length = file_size / sizeof(float);
-        if (emb_length % w != 0) return false;
         int h = int(emb_length / w);
-        if (n != -1 && h != n) return false;
+        if (emb_length % w != 0 || (n != -1 && h != n)) {
+            fclose(fp);
+            return false;
+        }
         fseek(fp, 0, SEEK_SET);
         weight.create(w, h);
-        fread(weight, sizeof(float), emb_length, fp);
+        size_t read = fread(weight, sizeof(float), emb_length, fp);
         fclose(fp);
+        if (read != emb_length) return false;
         LOGI("text embedding loaded!");
         return true;
     }
@@ -97,46 +174,204 @@ bool SynthesizerTrn::load_weight(const std::string &folder, Mat &weight, const s
     return false;
 }
 
-bool SynthesizerTrn::init(const std::string &model_folder, bool voice_convert, bool multi,
-                          const int n_vocab, AAssetManager *assetManager, Option &opt) {
+// name of every stage, in Stage bit order, and whether it is a net or a plain embedding
+static const struct {
+    const char *name;
+    bool net;
+} stages_info[] = {
+        {"emb_t",        false},
+        {"emb_g",        false},
+        {"enc_p",        true},
+        {"enc_q",        true},
+        {"dec",          true},
+        {"flow",         true},
+        {"flow.reverse", true},
+        {"dp",           true},
+};
+
+static int stage_index(unsigned stage) {
+    int i = 0;
+    while ((1u << i) != stage) i++;
+    return i;
+}
 
-    if (voice_convert) {
-        if (load_weight(model_folder, emb_t, "emb_t", 192, n_vocab) &&
-            load_weight(model_folder, emb_g, "emb_g", 256, -1) &&
-            load_model(model_folder, enc_q, "enc_q", multi, opt, assetManager) &&
-            load_model(model_folder, dec, "dec", multi, opt, assetManager) &&
-            load_model(model_folder, flow, "flow", multi, opt, assetManager) &&
-            load_model(model_folder, flow_reverse, "flow.reverse", multi, opt, assetManager))
-            return true;
-    } else if (multi) {
-        if (load_weight(model_folder, emb_t, "emb_t", 192, n_vocab) &&
-            load_weight(model_folder, emb_g, "emb_g", 256, -1) &&
-            load_model(model_folder, enc_p, "enc_p", multi, opt, assetManager) &&
-            load_model(model_folder, enc_q, "enc_q", multi, opt, assetManager) &&
-            load_model(model_folder, dec, "dec", multi, opt, assetManager) &&
-            load_model(model_folder, flow, "flow", multi, opt, assetManager) &&
-            load_model(model_folder, flow_reverse, "flow.reverse", multi, opt, assetManager) &&
-            load_model(model_folder, dp, "dp", multi, opt, assetManager))
-            return true;
+static size_t file_size(const std::string &path) {
+    struct stat st{};
+    if (stat(path.c_str(), &st) != 0) return 0;
+    return size_t(st.st_size);
+}
+
+std::string SynthesizerTrn::stage_file(unsigned stage) const {
+    std::string name = stages_info[stage_index(stage)].name;
+    if (!stages_info[stage_index(stage)].net) return join_path(model_folder, name + ".bin");
+    return net_weight_file(model_folder, name, weight_format);
+}
+
+unsigned SynthesizerTrn::entry_stages(bool voice_convert, bool multi) const {
+    if (voice_convert)
+        return STAGE_EMB_G | STAGE_ENC_Q | STAGE_FLOW | STAGE_FLOW_REVERSE | STAGE_DEC;
+    unsigned stages = STAGE_EMB_T | STAGE_ENC_P | STAGE_DP | STAGE_FLOW_REVERSE | STAGE_DEC;
+    if (multi) stages |= STAGE_EMB_G;
+    return stages;
+}
+
+bool SynthesizerTrn::init(const std::string &model_folder_, bool voice_convert, bool multi,
+                          const int n_vocab_, AAssetManager *assetManager, Option &opt,
+                          bool mmap_weights_, WeightFormat weight_format_) {
+    clear_nets();
+    mmap_weights = mmap_weights_;
+    weight_format = weight_format_;
+    model_folder = model_folder_;
+    multi_model = multi;
+    n_vocab = n_vocab_;
+    asset_manager = assetManager;
+    load_opt = opt;
+    model_fingerprint = model_folder + "|" + weight_format_name(weight_format) +
+                        (multi ? "|multi" : "|single");
+
+    unsigned stages = entry_stages(voice_convert, multi);
+    for (unsigned stage = 1; stage <= STAGE_DP; stage <<= 1) {
+        if (!(stages & stage)) continue;
+        std::string path = stage_file(stage);
+        struct stat st{};
+        if (stat(path.c_str(), &st) != 0 || st.st_size == 0) {
+            LOGE("%s not found", path.c_str());
+            return false;
+        }
+        model_fingerprint += "|" + path + ":" + std::to_string((long long) st.st_size) + ":" +
+                             std::to_string((long long) st.st_mtime);
+    }
+    // params are small, parsing them now turns a broken model into a failed init instead of
+    // empty audio on the first request
+    for (unsigned stage = 1; stage <= STAGE_DP; stage <<= 1) {
+        if ((stages & stage) && !parse_stage(stage)) {
+            clear_nets();
+            return false;
+        }
+    }
+    return true;
+}
+
+Net *SynthesizerTrn::stage_net(unsigned stage) {
+    switch (stage) {
+        case STAGE_ENC_P:
+            return &enc_p;
+        case STAGE_ENC_Q:
+            return &enc_q;
+        case STAGE_DEC:
+            return &dec;
+        case STAGE_FLOW:
+            return &flow;
+        case STAGE_FLOW_REVERSE:
+            return &flow_reverse;
+        case STAGE_DP:
+            return &dp;
+        default:
+            return nullptr;
+    }
+}
+
+bool SynthesizerTrn::parse_stage(unsigned stage) {
+    const char *name = stages_info[stage_index(stage)].name;
+    Net *net = stage_net(stage);
+    if (net == nullptr) {
+        // an embedding has no param, its file has to hold whole rows of the width load_weight reads
+        size_t row = (stage == STAGE_EMB_T ? 192 : 256) * sizeof(float);
+        size_t bytes = file_size(stage_file(stage));
+        if (bytes == 0 || bytes % row != 0 ||
+            (stage == STAGE_EMB_T && n_vocab != -1 && bytes / row != size_t(n_vocab))) {
+            LOGE("%s does not match the model", name);
+            return false;
+        }
     } else {
-        if (load_weight(model_folder, emb_t, "emb_t", 192, n_vocab) &&
-            load_model(model_folder, enc_p, "enc_p", multi, opt, assetManager) &&
-            load_model(model_folder, dec, "dec", multi, opt, assetManager) &&
-            load_model(model_folder, flow_reverse, "flow.reverse", multi, opt, assetManager) &&
-            load_model(model_folder, dp, "dp", multi, opt, assetManager))
-            return true;
+        net->opt = load_opt;
+        if (!load_param(*net, name, multi_model, asset_manager)) {
+            LOGE("%s param load fail", name);
+            return false;
+        }
     }
+    parsed_stages |= stage;
+    return true;
+}
 
-    return false;
+bool SynthesizerTrn::load_stage(unsigned stage) {
+    switch (stage) {
+        case STAGE_EMB_T:
+            return load_weight(model_folder, emb_t, "emb_t", 192, n_vocab);
+        case STAGE_EMB_G:
+            return load_weight(model_folder, emb_g, "emb_g", 256, -1);
+        default:
+            break;
+    }
+    Net *net = stage_net(stage);
+    if (net == nullptr) return false;
+    // stages outside the mode init was given are parsed on first use
+    if (!(parsed_stages & stage) && !parse_stage(stage)) return false;
+    return load_model(model_folder, *net, stages_info[stage_index(stage)].name);
+}
+
+bool SynthesizerTrn::require(unsigned stages) {
+    if ((loaded_stages.load() & stages) == stages) return true;
+    std::lock_guard<std::mutex> guard(load_lock);
+    bool ok = true;
+    for (unsigned stage = 1; stage <= STAGE_DP; stage <<= 1) {
+        if (!(stages & stage) || (loaded_stages.load() & stage)) continue;
+        const char *name = stages_info[stage_index(stage)].name;
+        double start = get_current_time();
+        if (!load_stage(stage)) {
+            LOGE("%s load fail", name);
+            failed_stages |= stage;
+            ok = false;
+            continue;
+        }
+        failed_stages &= ~stage;
+        NetLoadReport report;
+        report.name = name;
+        report.load_ms = get_current_time() - start;
+        report.bytes = file_size(stage_file(stage));
+        LOGI("%s: %.1f ms, %zu KB", name, report.load_ms, report.bytes / 1024);
+        load_reports.push_back(report);
+        loaded_stages |= stage;
+    }
+    return ok;
+}
+
+void SynthesizerTrn::prefetch(bool voice_convert) {
+    if (prefetch_thread.joinable()) prefetch_thread.join();
+    unsigned stages = entry_stages(voice_convert, multi_model);
+    prefetch_thread = std::thread([this, stages] { require(stages); });
+}
+
+bool SynthesizerTrn::load(bool voice_convert) {
+    return require(entry_stages(voice_convert, multi_model));
+}
+
+std::vector<NetLoadReport> SynthesizerTrn::load_report() {
+    std::lock_guard<std::mutex> guard(load_lock);
+    return load_reports;
+}
+
+std::string SynthesizerTrn::load_error() const {
+    unsigned failed = failed_stages.load();
+    if (failed == 0) return "";
+    std::string error = "failed to load";
+    for (unsigned stage = 1; stage <= STAGE_DP; stage <<= 1) {
+        if (failed & stage) error += std::string(" ") + stages_info[stage_index(stage)].name;
+    }
+    return error + " from " + model_folder;
 }
 
 std::vector<Mat>
 SynthesizerTrn::enc_p_forward(const Mat &x, bool vulkan, const Option &opt) {
-    Mat length(1);
+    Mat length(1, (size_t) 4u, opt.blob_allocator);
     length[0] = float(x.w);
-    Extractor ex = enc_p.create_extractor();
-    ex.set_num_threads(opt.num_threads);
-    ex.set_vulkan_compute(vulkan);
+    return enc_p_forward(x, length, vulkan, opt);
+}
+
+// length is the length of x, or for packed sentences the explicit 0 / 1 mask of every column
+std::vector<Mat>
+SynthesizerTrn::enc_p_forward(const Mat &x, const Mat &length, bool vulkan, const Option &opt) {
+    Extractor ex = new_extractor(enc_p, vulkan, opt);
     ex.input("in0", x);
     ex.input("in1", length);
     ex.input("in2", emb_t);
@@ -153,40 +388,46 @@ SynthesizerTrn::enc_p_forward(const Mat &x, bool vulkan, const Option &opt) {
 
 std::vector<Mat>
 SynthesizerTrn::enc_q_forward(const Mat &x, const Mat &g, bool vulkan, const Option &opt) {
-    Mat length(1);
+    Mat length(1, (size_t) 4u, opt.blob_allocator);
     length[0] = float(x.w);
-    Extractor ex = enc_q.create_extractor();
-    ex.set_num_threads(opt.num_threads);
-    ex.set_vulkan_compute(vulkan);
+    Extractor ex = new_extractor(enc_q, vulkan, opt);
     ex.input("in0", x);
     ex.input("in1", length);
-    ex.input("in2", g);
+    ex.input("in2", expanddims(g));
     Mat out0, out1;
     ex.extract("out0", out0);
     ex.extract("out1", out1);
     return std::vector<Mat>{out0, out1};
 }
 
-Mat SynthesizerTrn::emb_g_forward(int sid, const Option &opt) {
-    Mat sid_mat(1);
-    sid_mat[0] = (float) sid;
-    Mat out = embedding(sid_mat, emb_g, opt);
-    return out;
+Mat SynthesizerTrn::speaker_embedding(int sid) {
+    if (sid < 0 || sid >= emb_g.h) {
+        LOGE("speaker id %d out of range [0, %d)", sid, emb_g.h);
+        return {};
+    }
+    std::lock_guard<std::mutex> guard(speakers_lock);
+    if (speakers.size() != size_t(emb_g.h)) speakers.assign(size_t(emb_g.h), Mat());
+    Mat &g = speakers[sid];
+    if (g.empty()) {
+        // owned rather than a view of emb_g, ncnn copies shared blobs before writing in place.
+        // A (1 x 256) column: dp, flow and dec read h as the channels of their convolutions
+        g.create(1, emb_g.w);
+        memcpy(g, emb_g.row(sid), emb_g.w * sizeof(float));
+    }
+    return g;
 }
 
 Mat SynthesizerTrn::dp_forward(const Mat &x, const Mat &x_mask, const Mat &z, const Mat &g,
                                float noise_scale,
                                bool vulkan, const Option &opt) {
     Mat out;
-    Extractor ex = dp.create_extractor();
-    ex.set_num_threads(opt.num_threads);
-    ex.set_vulkan_compute(vulkan);
+    Extractor ex = new_extractor(dp, vulkan, opt);
     ex.input("in0", x);
     ex.input("in1", x_mask);
     ex.input("in2", z);
 
     Mat noise;
-    noise.create_like(z);
+    noise.create_like(z, opt.blob_allocator);
     noise.fill(noise_scale);
 
     if (!g.empty()) {
@@ -199,14 +440,14 @@ Mat SynthesizerTrn::dp_forward(const Mat &x, const Mat &x_mask, const Mat &z, co
     return out;
 }
 
+// enc_q, flow, flow.reverse and dec take g as a (1 x 256 x 1) blob, every caller passes the
+// (1 x 256) column of speaker_embedding and it is expanded here, dp reads the column as it is
 Mat SynthesizerTrn::flow_reverse_forward(const Mat &x, const Mat &x_mask, const Mat &g, bool vulkan,
                                          const Option &opt) {
-    Extractor ex = flow_reverse.create_extractor();
-    ex.set_num_threads(opt.num_threads);
-    ex.set_vulkan_compute(vulkan);
+    Extractor ex = new_extractor(flow_reverse, vulkan, opt);
     ex.input("in0", x);
     ex.input("in1", x_mask);
-    if (!g.empty()) ex.input("in2", g);
+    if (!g.empty()) ex.input("in2", expanddims(g));
     Mat out;
     ex.extract("out0", out);
     return out;
@@ -214,23 +455,19 @@ Mat SynthesizerTrn::flow_reverse_forward(const Mat &x, const Mat &x_mask, const
 
 Mat SynthesizerTrn::flow_forward(const Mat &x, const Mat &x_mask, const Mat &g, bool vulkan,
                                  const Option &opt) {
-    Extractor ex = flow.create_extractor();
-    ex.set_num_threads(opt.num_threads);
-    ex.set_vulkan_compute(vulkan);
+    Extractor ex = new_extractor(flow, vulkan, opt);
     ex.input("in0", x);
     ex.input("in1", x_mask);
-    ex.input("in2", g);
+    ex.input("in2", expanddims(g));
     Mat out;
     ex.extract("out0", out);
     return out;
 }
 
 Mat SynthesizerTrn::dec_forward(const Mat &x, const Mat &g, bool vulkan, const Option &opt) {
-    Extractor ex = dec.create_extractor();
-    ex.set_num_threads(opt.num_threads);
-    ex.set_vulkan_compute(vulkan);
+    Extractor ex = new_extractor(dec, vulkan, opt);
     ex.input("in0", x);
-    if (!g.empty()) ex.input("in1", g);
+    if (!g.empty()) ex.input("in1", expanddims(g));
     Mat out;
     ex.extract("out0", out);
     return out;
@@ -238,10 +475,22 @@ Mat SynthesizerTrn::dec_forward(const Mat &x, const Mat &g, bool vulkan, const O
 
 SynthesizerTrn::SynthesizerTrn() = default;
 
-// c++ implementation of SynthesizerTrn
-Mat SynthesizerTrn::forward(const Mat &data, const Option &opt, bool vulkan, bool multi,
-                            int sid, float noise_scale, float noise_scale_w, float length_scale) {
-    LOGI("processing...\n");
+// text encoder, duration predictor and alignment, everything before the flow
+void SynthesizerTrn::prepare_latent(const Mat &data, const Option &opt, bool vulkan, bool multi,
+                                    int sid, float noise_scale, float noise_scale_w,
+                                    float length_scale, int64_t seed, Mat &z_p, Mat &y_mask,
+                                    Mat &g, SynthesisProfile *profile) {
+    z_p.release();
+    y_mask.release();
+    g.release();
+    if (!require(entry_stages(false, multi) & ~(STAGE_FLOW_REVERSE | STAGE_DEC))) return;
+    if (multi) {
+        g = speaker_embedding(sid);
+        if (g.empty()) return;
+    }
+    // every randn / RandnLike below draws from this seed's stream, in a fixed order
+    NoiseScope noise(seed);
+    double stage_start = get_current_time();
     // enc_p
     auto enc_p_out = enc_p_forward(data, vulkan, opt);
     Mat x = enc_p_out[0];
@@ -249,16 +498,36 @@ Mat SynthesizerTrn::forward(const Mat &data, const Option &opt, bool vulkan, boo
     Mat logs_p = enc_p_out[2];
     Mat x_mask = enc_p_out[3];
 
-    Mat g;
-    if (multi) {
-        g = reducedims(mattranspose(emb_g_forward(sid, opt), opt));
+    if (profile) {
+        double now = get_current_time();
+        profile->enc_p = now - stage_start;
+        profile->t_x = x.w;
+        stage_start = now;
     }
 
     Mat z = randn(x.w, 2, opt, 1);
 
     Mat logw = dp_forward(x, x_mask, z, g, noise_scale_w, vulkan, opt);
 
-    Mat w = product(matproduct(matexp(logw, opt), x_mask, opt), length_scale, opt);
+    if (profile) {
+        double now = get_current_time();
+        profile->dp = now - stage_start;
+        stage_start = now;
+    }
+
+    align_latent(logw, x_mask, m_p, logs_p, noise_scale, length_scale, opt, z_p, y_mask);
+
+    if (profile) {
+        profile->align = get_current_time() - stage_start;
+        profile->t_y = z_p.w;
+    }
+}
+
+// durations from logw, then m_p / logs_p expanded to frames and sampled into z_p
+void SynthesizerTrn::align_latent(const Mat &logw, const Mat &x_mask, const Mat &m_p_,
+                                  const Mat &logs_p_, float noise_scale, float length_scale,
+                                  const Option &opt, Mat &z_p, Mat &y_mask) {
+    Mat w = expr::eval(expr::exp(logw) * x_mask * length_scale, opt);
 
     Mat w_ceil = ceil(w, opt);
 
@@ -266,52 +535,223 @@ Mat SynthesizerTrn::forward(const Mat &data, const Option &opt, bool vulkan, boo
 
     if (summed[0] < 1) summed[0] = 1;
 
-    Mat y_mask = sequence_mask(summed, opt, summed[0]);
+    y_mask = sequence_mask(summed, opt, summed[0]);
 
     y_mask = mattranspose(y_mask, opt);
     y_mask = reducedims(y_mask);
 
-    Mat attn_mask = matmul(y_mask, x_mask, opt);
-    attn_mask = reducedims(attn_mask);
+    // the alignment path is monotonic, so attn x m_p is a repeat of m_p's columns by w_ceil,
+    // masked tokens have a duration of 0 and are skipped
+    Mat m_p = expand_by_duration(m_p_, w_ceil, int(summed[0]), opt);
+    Mat logs_p = expand_by_duration(logs_p_, w_ceil, int(summed[0]), opt);
 
-    Mat attn = generate_path(w_ceil, attn_mask, opt);
+    Mat m_p_rand = randn(m_p.w, m_p.h, opt);
 
-    m_p = matmul(attn, reducedims(mattranspose(m_p, opt)), opt);
-    m_p = reducedims(mattranspose(m_p, opt));
+    z_p = expr::eval(m_p + m_p_rand * expr::exp(logs_p) * noise_scale, opt);
+}
 
-    logs_p = matmul(attn, reducedims(mattranspose(logs_p, opt)), opt);
-    logs_p = reducedims(mattranspose(logs_p, opt));
+// masked columns between two packed sentences, dp's widest convolution (kernel 3, dilation 9)
+// reads 9 columns to each side and sees only zeros there, exactly like its padding
+static const int pack_gap = 9;
+
+bool SynthesizerTrn::prepare_latents(const std::vector<Mat> &sentences, const Option &opt,
+                                     bool vulkan, bool multi, int sid, float noise_scale,
+                                     float noise_scale_w, float length_scale, int64_t seed,
+                                     std::vector<Mat> &z_ps, std::vector<Mat> &y_masks, Mat &g) {
+    const int n = int(sentences.size());
+    z_ps.assign(n, Mat());
+    y_masks.assign(n, Mat());
+    if (n == 0) return true;
+    if (!require(entry_stages(false, multi) & ~(STAGE_FLOW_REVERSE | STAGE_DEC))) return false;
+    g.release();
+    if (multi) {
+        g = speaker_embedding(sid);
+        if (g.empty()) return false;
+    }
 
-    Mat m_p_rand = randn(m_p.w, m_p.h, opt);
+    std::vector<int> offsets(n);
+    int t_x = 0;
+    for (int i = 0; i < n; i++) {
+        if (sentences[i].empty()) return false;
+        offsets[i] = t_x;
+        t_x += sentences[i].w + (i + 1 < n ? pack_gap : 0);
+    }
 
-    Mat z_p = matplus(m_p,
-                      product(matproduct(m_p_rand, matexp(logs_p, opt), opt), noise_scale, opt),
-                      opt);
+    // tokens of the gaps are 0 and masked out, the encoder never mixes columns across them
+    Mat tokens(t_x, 1, (size_t) 4u, opt.blob_allocator);
+    Mat mask(t_x, (size_t) 4u, opt.blob_allocator);
+    if (tokens.empty() || mask.empty()) return false;
+    tokens.fill(0.f);
+    mask.fill(0.f);
+    for (int i = 0; i < n; i++) {
+        memcpy((float *) tokens + offsets[i], sentences[i], sentences[i].w * sizeof(float));
+        std::fill((float *) mask + offsets[i], (float *) mask + offsets[i] + sentences[i].w, 1.f);
+    }
 
-    z = flow_reverse_forward(expanddims(z_p), mattranspose(expanddims(y_mask), opt), expanddims(g),
-                             vulkan, opt);
+    auto enc_p_out = enc_p_forward(tokens, mask, vulkan, opt);
+    Mat x = enc_p_out[0];
+    Mat m_p = enc_p_out[1];
+    Mat logs_p = enc_p_out[2];
+    Mat x_mask = enc_p_out[3];
+    if (x.w != t_x) return false;
+
+    // every sentence draws the noise it would draw alone: its dp noise here and its latent
+    // noise below come from its own stream, in the same order as prepare_latent
+    std::vector<int64_t> seeds(n);
+    Mat z(t_x, 2, 1, (size_t) 4u, opt.blob_allocator);
+    if (z.empty()) return false;
+    z.fill(0.f);
+    for (int i = 0; i < n; i++) {
+        seeds[i] = seed < 0 ? int64_t(random_seed() >> 1) : seed;
+        NoiseScope noise(seeds[i]);
+        Mat z_i = randn(sentences[i].w, 2, opt, 1);
+        for (int r = 0; r < 2; r++) {
+            memcpy(z.row(r) + offsets[i], z_i.row(r), sentences[i].w * sizeof(float));
+        }
+    }
 
-    y_mask = mattranspose(y_mask, opt);
+    Mat logw = dp_forward(x, x_mask, z, g, noise_scale_w, vulkan, opt);
+    if (logw.w != t_x) return false;
+
+    for (int i = 0; i < n; i++) {
+        int left = offsets[i];
+        int right = left + sentences[i].w;
+        NoiseScope noise(seeds[i]);
+        // replay the dp draw so the stream is where prepare_latent would have it
+        randn(sentences[i].w, 2, opt, 1);
+        align_latent(Slice(logw, 0, logw.h, left, right, 1, 1, opt),
+                     Slice(x_mask, 0, x_mask.h, left, right, 1, 1, opt),
+                     Slice(m_p, 0, m_p.h, left, right, 1, 1, opt),
+                     Slice(logs_p, 0, logs_p.h, left, right, 1, 1, opt),
+                     noise_scale, length_scale, opt, z_ps[i], y_masks[i]);
+        if (z_ps[i].empty()) return false;
+    }
+    return true;
+}
+
+// flow.reverse and decoder, y_mask is the (t_y x 1) column mask of z_p
+Mat SynthesizerTrn::decode_latent(const Mat &z_p, const Mat &y_mask_, const Mat &g, bool vulkan,
+                                  const Option &opt, SynthesisProfile *profile) {
+    if (z_p.empty() || !require(STAGE_FLOW_REVERSE | STAGE_DEC)) return Mat();
+    double stage_start = get_current_time();
+    Mat z = flow_reverse_forward(expanddims(z_p), mattranspose(expanddims(y_mask_), opt), g,
+                                 vulkan, opt);
+
+    if (profile) {
+        double now = get_current_time();
+        profile->flow_reverse = now - stage_start;
+        stage_start = now;
+    }
+
+    Mat y_mask = mattranspose(y_mask_, opt);
 
     y_mask = expand(y_mask, z.w, z.h, opt);
-    Mat o = dec_forward(reducedims(matproduct(z, y_mask, opt)), expanddims(g),
-                        vulkan, opt);
+    Mat o = dec_forward(reducedims(matproduct(z, y_mask, opt)), g, vulkan, opt);
+
+    if (profile) profile->dec = get_current_time() - stage_start;
+    return o;
+}
+
+// c++ implementation of SynthesizerTrn
+Mat SynthesizerTrn::forward(const Mat &data, const Option &opt, bool vulkan, bool multi,
+                            int sid, float noise_scale, float noise_scale_w, float length_scale,
+                            int64_t seed, SynthesisProfile *profile) {
+    LOGI("processing...\n");
+    Mat z_p, y_mask, g;
+    prepare_latent(data, opt, vulkan, multi, sid, noise_scale, noise_scale_w, length_scale, seed,
+                   z_p, y_mask, g, profile);
+    Mat o = decode_latent(z_p, y_mask, g, vulkan, opt, profile);
 
     LOGI("finished!\n");
     return o;
 }
 
+bool SynthesizerTrn::forward_stream(const Mat &data, const AudioChunkCallback &callback,
+                                    const Option &opt, bool vulkan, bool multi, int sid,
+                                    float noise_scale, float noise_scale_w, float length_scale,
+                                    int64_t seed, int chunk_frames, int context_frames,
+                                    int fade_frames) {
+    LOGI("processing (streaming)...\n");
+    Mat z_p, y_mask, g;
+    prepare_latent(data, opt, vulkan, multi, sid, noise_scale, noise_scale_w, length_scale, seed,
+                   z_p, y_mask, g);
+    if (z_p.empty()) return false;
+
+    if (!decode_stream(z_p, y_mask, g, callback, opt, vulkan, chunk_frames, context_frames,
+                       fade_frames))
+        return false;
+
+    LOGI("finished!\n");
+    return true;
+}
+
+bool SynthesizerTrn::decode_stream(const Mat &z_p, const Mat &y_mask, const Mat &g,
+                                   const AudioChunkCallback &callback, const Option &opt,
+                                   bool vulkan, int chunk_frames, int context_frames,
+                                   int fade_frames) {
+    if (z_p.empty() || !require(STAGE_FLOW_REVERSE | STAGE_DEC)) return false;
+    chunk_frames = std::max(chunk_frames, 1);
+    context_frames = std::max(context_frames, 0);
+    // the fade tail is taken from the right context of the previous window
+    fade_frames = std::min(std::max(fade_frames, 0), std::min(context_frames, chunk_frames));
+
+    const int t_y = z_p.w;
+    std::vector<float> tail;
+    for (int start = 0; start < t_y; start += chunk_frames) {
+        int end = std::min(start + chunk_frames, t_y);
+        int left = std::max(start - context_frames, 0);
+        int right = std::min(end + context_frames, t_y);
+
+        Mat z_slice = Slice(z_p, 0, z_p.h, left, right, 1, 1, opt);
+        Mat mask_slice = Slice(y_mask, left, right, 0, y_mask.w, 1, 1, opt);
+        Mat o = reducedims(decode_latent(z_slice, mask_slice, g, vulkan, opt));
+        if (o.empty()) return false;
+
+        // samples per latent frame, fixed by the decoder's upsampling
+        const int hop = o.w / (right - left);
+        const float *window = (const float *) o + (start - left) * hop;
+        int length = (end - start) * hop;
+
+        Mat chunk(length, 1);
+        memcpy(chunk, window, length * sizeof(float));
+
+        // blend the head of this window with the tail the previous window decoded past its end
+        int fade_length = std::min(int(tail.size()), length);
+        float *chunk_ptr = chunk;
+        for (int i = 0; i < fade_length; i++) {
+            float alpha = (float(i) + 0.5f) / float(fade_length);
+            chunk_ptr[i] = tail[i] * (1.f - alpha) + chunk_ptr[i] * alpha;
+        }
+
+        tail.clear();
+        if (end < t_y) {
+            const float *tail_ptr = window + length;
+            int tail_length = std::min(fade_frames * hop, o.w - (end - left) * hop);
+            tail.assign(tail_ptr, tail_ptr + std::max(tail_length, 0));
+        }
+
+        if (!callback(chunk)) {
+            LOGI("streaming stopped by caller\n");
+            return false;
+        }
+    }
+    return true;
+}
+
 Mat SynthesizerTrn::voice_convert(const Mat &audio, int raw_sid, int target_sid,
-                                  const Option &opt, bool vulkan) {
+                                  const Option &opt, bool vulkan, int64_t seed) {
+    if (!require(entry_stages(true, true))) return Mat();
 
     LOGI("start converting...\n");
-    // stft transform
-    auto spec = stft(audio, 1024, 256, 1024, opt)[0];
-    spec = matsqrt(Plus(matpow(spec, 2, opt), 1e-6, opt), opt);
+    // enc_q samples its posterior with RandnLike
+    NoiseScope noise(seed);
+    // linear spectrogram, sqrt(real^2 + imag^2 + 1e-6) as in spectrogram_torch
+    auto spec = stft_magnitude(audio, 1024, 256, 1024, opt);
 
     // voice conversion
-    auto g_src = mattranspose(emb_g_forward(raw_sid, opt), opt);
-    auto g_tgt = mattranspose(emb_g_forward(target_sid, opt), opt);
+    Mat g_src = speaker_embedding(raw_sid);
+    Mat g_tgt = speaker_embedding(target_sid);
+    if (g_src.empty() || g_tgt.empty()) return {};
     auto enc_q_out = enc_q_forward(spec, g_src, vulkan, opt);
     auto z = expanddims(enc_q_out[0]);
     auto y_mask = enc_q_out[1];
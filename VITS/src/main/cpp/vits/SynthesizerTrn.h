@@ -1,10 +1,51 @@
 #ifndef SYNTHESIZERTRN_H
 #define SYNTHESIZERTRN_H
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "utils.h"
+#include "mapped_file.h"
+#include "weight_format.h"
 #include "../openjtalk/asset_manager_api/manager.h"
 
+// wall time of each stage of one forward call in ms, filled when passed to forward
+struct SynthesisProfile {
+    double enc_p = 0;
+    double dp = 0;
+    double align = 0;
+    double flow_reverse = 0;
+    double dec = 0;
+    int t_x = 0;
+    int t_y = 0;
+};
+
+// how long one net or embedding took to load and the size of its weight file
+struct NetLoadReport {
+    std::string name;
+    double load_ms = 0;
+    size_t bytes = 0;
+};
+
+// receives one block of streamed audio, return false to stop synthesis early
+typedef std::function<bool(const Mat &audio)> AudioChunkCallback;
+
 class SynthesizerTrn {
+public:
+    // the parts of a model, loaded independently on first use
+    enum Stage : unsigned {
+        STAGE_EMB_T = 1u << 0,
+        STAGE_EMB_G = 1u << 1,
+        STAGE_ENC_P = 1u << 2,
+        STAGE_ENC_Q = 1u << 3,
+        STAGE_DEC = 1u << 4,
+        STAGE_FLOW = 1u << 5,
+        STAGE_FLOW_REVERSE = 1u << 6,
+        STAGE_DP = 1u << 7,
+    };
+
 private:
     Mat emb_t;
     Mat emb_g;
@@ -16,22 +57,67 @@ private:
     Net flow;
     Net dp;
 
+    // weight files the nets and embeddings reference when loaded with mmap_weights, released
+    // after the nets
+    bool mmap_weights = true;
+    std::vector<std::unique_ptr<MappedFile>> mappings;
+    WeightFormat weight_format = WEIGHTS_FP32;
+
+    // what init was given, stages are loaded from it when first required
+    std::string model_folder;
+    bool multi_model = false;
+    int n_vocab = -1;
+    AAssetManager *asset_manager = nullptr;
+    Option load_opt;
+    std::string model_fingerprint;
+
+    std::mutex load_lock;
+    // stages whose param is parsed, weights are only loaded into those
+    unsigned parsed_stages = 0;
+    std::atomic<unsigned> loaded_stages{0};
+    // stages whose last load attempt failed
+    std::atomic<unsigned> failed_stages{0};
+    std::vector<NetLoadReport> load_reports;
+    std::thread prefetch_thread;
+
+    std::mutex speakers_lock;
+    std::vector<Mat> speakers;
+
     void clear_nets();
 
-    static bool
+    // stages forward / voice_convert run, emb_g only for multi speaker models
+    unsigned entry_stages(bool voice_convert, bool multi) const;
+
+    // loads the missing stages among the given ones, false if any of them failed
+    bool require(unsigned stages);
+
+    bool load_stage(unsigned stage);
+
+    // the net of a stage, nullptr for the embeddings
+    Net *stage_net(unsigned stage);
+
+    // parses the param of a net stage, or checks the file of an embedding holds whole rows
+    bool parse_stage(unsigned stage);
+
+    // weight file of a stage, the one in weight_format if the model folder has it
+    std::string stage_file(unsigned stage) const;
+
+    const MappedFile *map_file(const std::string &path);
+
+    bool
     load_weight(const std::string &folder, Mat &weight, const std::string &name, const int w,
                 const int n);
 
-    static bool
-    load_model(const std::string &folder, Net &net, const string &name, bool multi,
-               const Option &opt, AAssetManager *assetManager);
+    // loads the weights of net name into its parsed param
+    bool load_model(const std::string &folder, Net &net, const string &name);
 
     std::vector<Mat>
     enc_p_forward(const Mat &x, bool vulkan, const Option &opt);
 
-    std::vector<Mat> enc_q_forward(const Mat &x, const Mat &g, bool vulkan, const Option &opt);
+    std::vector<Mat>
+    enc_p_forward(const Mat &x, const Mat &length, bool vulkan, const Option &opt);
 
-    Mat emb_g_forward(int sid, const Option &opt);
+    std::vector<Mat> enc_q_forward(const Mat &x, const Mat &g, bool vulkan, const Option &opt);
 
     Mat dp_forward(const Mat &x, const Mat &x_mask, const Mat &z, const Mat &g, float noise_scale,
                    bool vulkan, const Option &opt);
@@ -43,19 +129,99 @@ private:
 
     Mat dec_forward(const Mat &x, const Mat &g, bool vulkan, const Option &opt);
 
+    void align_latent(const Mat &logw, const Mat &x_mask, const Mat &m_p, const Mat &logs_p,
+                      float noise_scale, float length_scale, const Option &opt, Mat &z_p,
+                      Mat &y_mask);
+
+    Mat decode_latent(const Mat &z_p, const Mat &y_mask, const Mat &g, bool vulkan,
+                      const Option &opt, SynthesisProfile *profile = nullptr);
+
 public:
 
+    // checks that the weight files of the mode exist and parses the param of every net it runs,
+    // so a missing or broken model fails here. No weights are loaded yet: every entry point
+    // loads the nets it runs on first use (voice conversion never pays for enc_p / dp, speech
+    // never for enc_q / flow), prefetch() or load() do it ahead.
+    // mmap_weights references the .bin files from read only mappings instead of copying them
+    // to the heap, weights in the page cache are then shared and can be evicted when cold.
+    // weight_format picks the <net>.fp16 / .int8 variants written by vits_quantize, nets
+    // without one load from the fp32 file
     bool init(const std::string &model_folder, bool voice_convert, bool multi, const int n_vocab,
-              AAssetManager *assetManager, Option &opt);
+              AAssetManager *assetManager, Option &opt, bool mmap_weights = true,
+              WeightFormat weight_format = WEIGHTS_FP32);
 
     SynthesizerTrn();
 
+    // registers the custom layers of the VITS nets and loads the param of net name
+    static bool load_param(Net &net, const std::string &name, bool multi,
+                           AAssetManager *assetManager);
+
+    // loads the stages of forward (or voice_convert) on a background thread, a request arriving
+    // meanwhile waits only for the stages it still misses
+    void prefetch(bool voice_convert);
+
+    // loads the stages of forward (or voice_convert) now
+    bool load(bool voice_convert);
+
+    // one entry per stage loaded so far, in load order
+    std::vector<NetLoadReport> load_report();
+
+    // names the stages whose last load failed, empty while every load succeeded. An entry point
+    // returning nothing with this set failed on the model, not on its input
+    std::string load_error() const;
+
+    // names the model init was given: its folder, weight format and speaker mode, and the size
+    // and modification time of every weight file it runs on. Replacing a file changes it
+    const std::string &fingerprint() const { return model_fingerprint; }
+
+    // g of speaker sid, a (1 x 256) column copied from emb_g into the speaker table on first use
+    // and shared by every request after. Empty for a sid the model does not have, or before
+    // emb_g is loaded
+    Mat speaker_embedding(int sid);
+
+    // rows of emb_g, 0 for single speaker models
+    int speaker_count() const { return emb_g.h; }
+
+    // the row table itself, for checking speaker_embedding against
+    const Mat &speaker_table() const { return emb_g; }
+
+    // seed fixes the noise of enc_p / dp sampling, the same seed and inputs give the same audio
+    // for any thread count. A negative seed draws a random one
     Mat forward(const Mat &x, const Option &opt, bool vulkan = false, bool multi = false,
                 int sid = 0, float noise_scale = .667, float noise_scale_w = 0.8,
-                float length_scale = 1);
+                float length_scale = 1, int64_t seed = -1, SynthesisProfile *profile = nullptr);
+
+    // decode z_p in overlapping windows of chunk_frames and hand each block to callback as soon
+    // as it is ready, neighbouring windows share context_frames of latent and are cross-faded
+    // over fade_frames at the seams
+    bool forward_stream(const Mat &x, const AudioChunkCallback &callback, const Option &opt,
+                        bool vulkan = false, bool multi = false, int sid = 0,
+                        float noise_scale = .667, float noise_scale_w = 0.8,
+                        float length_scale = 1, int64_t seed = -1, int chunk_frames = 64,
+                        int context_frames = 16, int fade_frames = 4);
+
+    // the two halves of forward_stream, so a scheduler can run them for different sentences at
+    // the same time: prepare_latent is enc_p / dp / alignment and yields z_p, its (t_y x 1) mask
+    // and the speaker embedding, decode_stream is flow.reverse and dec over windows of z_p
+    void prepare_latent(const Mat &x, const Option &opt, bool vulkan, bool multi, int sid,
+                        float noise_scale, float noise_scale_w, float length_scale, int64_t seed,
+                        Mat &z_p, Mat &y_mask, Mat &g, SynthesisProfile *profile = nullptr);
+
+    // prepare_latent for several sentences in one enc_p and one dp pass: they are packed into
+    // one sequence with masked gaps, which the convolutions treat as padding and attention does
+    // not cross. Each sentence gets the same noise, and so the same latent, as from
+    // prepare_latent with seed
+    bool prepare_latents(const std::vector<Mat> &sentences, const Option &opt, bool vulkan,
+                         bool multi, int sid, float noise_scale, float noise_scale_w,
+                         float length_scale, int64_t seed, std::vector<Mat> &z_ps,
+                         std::vector<Mat> &y_masks, Mat &g);
+
+    bool decode_stream(const Mat &z_p, const Mat &y_mask, const Mat &g,
+                       const AudioChunkCallback &callback, const Option &opt, bool vulkan = false,
+                       int chunk_frames = 64, int context_frames = 16, int fade_frames = 4);
 
     Mat voice_convert(const Mat &x, int raw_sid, int target_sid, const Option &opt,
-                      bool vulkan = false);
+                      bool vulkan = false, int64_t seed = -1);
 
     ~SynthesizerTrn();
 };
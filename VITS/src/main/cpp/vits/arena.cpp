@@ -0,0 +1,104 @@
+#include "arena.h"
+#include "utils.h"
+
+// size classes per octave, class c holds blocks of (4 + c % 4) << (c / 4 - 2) bytes
+#define ARENA_CLASS_STEPS 4
+// smallest size class, 64 bytes
+#define ARENA_MIN_CLASS (6 * ARENA_CLASS_STEPS)
+// every block starts with a header of one alignment unit that records its size class, so the
+// pointer handed out keeps the alignment of ncnn::fastMalloc
+#define ARENA_HEADER NCNN_MALLOC_ALIGN
+
+static size_t class_bytes(int c) {
+    return size_t(ARENA_CLASS_STEPS + c % ARENA_CLASS_STEPS) << (c / ARENA_CLASS_STEPS - 2);
+}
+
+static int size_class(size_t size) {
+    // octave first, size <= 2 << octave afterwards, then the step inside it
+    int octave = ARENA_MIN_CLASS / ARENA_CLASS_STEPS;
+    while ((size_t(2) << octave) < size) octave++;
+    int c = octave * ARENA_CLASS_STEPS;
+    while (class_bytes(c) < size) c++;
+    return c;
+}
+
+ArenaAllocator::ArenaAllocator(size_t budget_bytes)
+        : free_blocks(sizeof(size_t) * 8 * ARENA_CLASS_STEPS),
+          in_use(sizeof(size_t) * 8 * ARENA_CLASS_STEPS),
+          peak(sizeof(size_t) * 8 * ARENA_CLASS_STEPS), budget_bytes(budget_bytes) {}
+
+ArenaAllocator::~ArenaAllocator() {
+    if (live_blocks != 0) LOGE("arena destroyed with %zu blocks still in use", live_blocks);
+    clear();
+}
+
+void *ArenaAllocator::fastMalloc(size_t size) {
+    int c = size_class(size + ARENA_HEADER);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        live_blocks++;
+        if (++in_use[c] > peak[c]) peak[c] = in_use[c];
+        std::vector<void *> &blocks = free_blocks[c];
+        if (!blocks.empty()) {
+            auto *block = (unsigned char *) blocks.back();
+            blocks.pop_back();
+            cached_bytes -= class_bytes(c);
+            return block + ARENA_HEADER;
+        }
+    }
+    auto *block = (unsigned char *) ncnn::fastMalloc(class_bytes(c));
+    if (block == nullptr) {
+        std::lock_guard<std::mutex> guard(lock);
+        live_blocks--;
+        in_use[c]--;
+        return nullptr;
+    }
+    *(int *) block = c;
+    return block + ARENA_HEADER;
+}
+
+void ArenaAllocator::fastFree(void *ptr) {
+    if (ptr == nullptr) return;
+    auto *block = (unsigned char *) ptr - ARENA_HEADER;
+    int c = *(int *) block;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        live_blocks--;
+        in_use[c]--;
+        if (cached_bytes + class_bytes(c) <= budget_bytes) {
+            free_blocks[c].push_back(block);
+            cached_bytes += class_bytes(c);
+            return;
+        }
+    }
+    ncnn::fastFree(block);
+}
+
+void ArenaAllocator::reset() {
+    std::vector<void *> released;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (live_blocks != 0) LOGW("arena reset with %zu blocks still in use", live_blocks);
+        for (size_t c = 0; c < free_blocks.size(); c++) {
+            // blocks still in use count against what the class may keep
+            size_t keep = peak[c] > in_use[c] ? peak[c] - in_use[c] : 0;
+            std::vector<void *> &blocks = free_blocks[c];
+            while (blocks.size() > keep) {
+                released.push_back(blocks.back());
+                blocks.pop_back();
+                cached_bytes -= class_bytes(int(c));
+            }
+            peak[c] = in_use[c];
+        }
+    }
+    for (void *block: released) ncnn::fastFree(block);
+}
+
+void ArenaAllocator::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (std::vector<void *> &blocks: free_blocks) {
+        for (void *block: blocks) ncnn::fastFree(block);
+        blocks.clear();
+    }
+    cached_bytes = 0;
+}
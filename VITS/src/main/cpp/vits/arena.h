@@ -0,0 +1,52 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <mutex>
+#include <vector>
+#include "allocator.h"
+
+using namespace ncnn;
+
+// blob allocator of one synthesis context: blocks are rounded up to a size class and a freed
+// block goes back to the free list of its class instead of to the system, so the next request
+// of similar length is served without malloc / free or fresh page faults. Classes are a quarter
+// of an octave apart, a block is at most 25% larger than asked for.
+// reset() marks the end of a request, clear() gives the cached blocks back
+class ArenaAllocator : public Allocator {
+private:
+    std::mutex lock;
+    // free blocks by size class, see class_bytes() in arena.cpp for the size of class i
+    std::vector<std::vector<void *>> free_blocks;
+    // blocks of each class handed out now, and the most at once since the last reset()
+    std::vector<size_t> in_use;
+    std::vector<size_t> peak;
+    size_t live_blocks = 0;
+    size_t cached_bytes = 0;
+    size_t budget_bytes;
+
+public:
+    // blocks beyond budget_bytes of cache are returned to the system when freed
+    explicit ArenaAllocator(size_t budget_bytes = size_t(256) << 20);
+
+    ~ArenaAllocator() override;
+
+    void *fastMalloc(size_t size) override;
+
+    void fastFree(void *ptr) override;
+
+    // end of a request: every class keeps as many free blocks as the request needed at once,
+    // the rest (left over from longer requests before it) goes back to the system
+    void reset();
+
+    // release every cached block
+    void clear();
+
+    size_t cached() const { return cached_bytes; }
+
+private:
+    ArenaAllocator(const ArenaAllocator &);
+
+    ArenaAllocator &operator=(const ArenaAllocator &);
+};
+
+#endif
@@ -5,6 +5,7 @@
 #include <vector>
 #include <numeric>
 #include "utils.h"
+#include "expr.h"
 
 // definition of custom layers
 
@@ -29,7 +30,7 @@ public:
             return 0;
         }
 
-        top_blob.create_like(to);
+        top_blob.create_like(to, opt.blob_allocator);
         if (top_blob.empty()) return -100;
 
         if (w == w_t && h == 1) {
@@ -91,6 +92,8 @@ public:
     }
 };
 
+// inverse piecewise rational quadratic spline of the duration predictor's flows, fused: every row
+// of inputs builds its bins on the stack, searches its bin and solves the quadratic in one pass
 class PRQTransform : public Layer {
 public:
     PRQTransform() = default;
@@ -100,186 +103,101 @@ public:
         const Mat &inputs = bottom_blobs[1];
         const Mat &unnormalized_widths = bottom_blobs[2];
         const Mat &unnormalized_heights = bottom_blobs[3];
-        const Mat &unnormalized_derivatives_ = bottom_blobs[0];
+        const Mat &unnormalized_derivatives = bottom_blobs[0];
 
         Mat &top_blob = top_blobs[0];
 
-        float left = -5.0;
-        float right = 5.0;
-        float bottom = -5.0;
-        float top = 5.0;
-        float min_bin_width = 1e-3;
-        float min_bin_height = 1e-3;
-        float min_derivative = 1e-3;
-        float num_bins = unnormalized_widths.w;
+        const float left = -5.0;
+        const float right = 5.0;
+        const float bottom = -5.0;
+        const float top = 5.0;
+        const float min_bin_width = 1e-3;
+        const float min_bin_height = 1e-3;
+        const float min_derivative = 1e-3;
+        const float eps = 1e-6;
+        const int num_bins = unnormalized_widths.w;
 
-        float constant = log(exp(1 - min_derivative) - 1);
-        Mat unnormalized_derivatives = unnormalized_derivatives_.clone();
-        set_column_value(unnormalized_derivatives, 0, constant, opt);
-        set_column_value(unnormalized_derivatives, -1, constant, opt);
+        if (inputs.empty() || num_bins <= 0 || num_bins >= max_bins) return -100;
+        if (unnormalized_heights.w != num_bins || unnormalized_derivatives.w != num_bins + 1)
+            return -100;
 
-        Mat widths = softmax(unnormalized_widths, opt);
-        if (widths.empty()) return -100;
+        const float constant = log(exp(1 - min_derivative) - 1);
+        const int rows = inputs.h;
 
-#pragma omp parallel for num_threads(opt.num_threads)
-        for (int i = 0; i < widths.c; i++) {
-            float *ptr = widths.channel(i);
-            for (int j = 0; j < widths.w * widths.h; j++) {
-                ptr[j] = (1 - min_bin_width * num_bins) * ptr[j] + min_bin_width;
-            }
-        }
-
-        Mat cumwidths = cumsum(widths, opt);
-
-        cumwidths = pad(cumwidths, 0, 0, 1, 0, 0, opt);
-
-#pragma omp parallel for num_threads(opt.num_threads)
-        for (int i = 0; i < cumwidths.c; i++) {
-            float *ptr = cumwidths.channel(i);
-            for (int j = 0; j < cumwidths.w * cumwidths.h; j++) {
-                ptr[j] = (right - left) * ptr[j] + left;
-            }
-        }
-
-        set_column_value(cumwidths, 0, left, opt);
-        set_column_value(cumwidths, -1, right, opt);
-
-#pragma omp parallel for num_threads(opt.num_threads)
-        for (int i = 0; i < widths.c; i++) {
-            float *widths_ptr = widths.channel(i);
-            float *cumwidths_ptr = cumwidths.channel(i);
-            for (int j = 0; j < widths.h; j++) {
-                for (int k = 0; k < widths.w; k++) {
-                    widths_ptr[k] = cumwidths_ptr[k + 1] - cumwidths_ptr[k];
-                }
-                widths_ptr += widths.w;
-                cumwidths_ptr += cumwidths.w;
-            }
-        }
-
-        Mat derivatives = softplus(unnormalized_derivatives, opt);
-
-#pragma omp parallel for num_threads(opt.num_threads)
-        for (int i = 0; i < derivatives.c; i++) {
-            float *d_ptr = derivatives.channel(i);
-            for (int j = 0; j < derivatives.w * derivatives.h; j++) {
-                d_ptr[j] += min_derivative;
-            }
-        }
+        top_blob.create_like(inputs, opt.blob_allocator);
+        if (top_blob.empty()) return -100;
 
-        Mat heights = softmax(unnormalized_heights, opt);
 #pragma omp parallel for num_threads(opt.num_threads)
-        for (int i = 0; i < heights.c; i++) {
-            float *h_ptr = heights.channel(i);
-            for (int j = 0; j < heights.w * heights.h; j++) {
-                h_ptr[j] = min_bin_height + (1. - min_bin_height * num_bins) * h_ptr[j];
-            }
+        for (int n = 0; n < inputs.c * rows; n++) {
+            const int q = n / rows;
+            const int j = n % rows;
+            const float *uw = unnormalized_widths.channel(q).row(j);
+            const float *uh = unnormalized_heights.channel(q).row(j);
+            const float *ud = unnormalized_derivatives.channel(q).row(j);
+            const float x = inputs.channel(q)[j];
+
+            float cumwidths[max_bins + 1];
+            float cumheights[max_bins + 1];
+            bin_edges(uw, num_bins, min_bin_width, left, right, cumwidths);
+            bin_edges(uh, num_bins, min_bin_height, bottom, top, cumheights);
+
+            // searchsorted with the last edge nudged up, clamped so that x == top stays in range
+            int idx = -1;
+            for (int k = 0; k < num_bins; k++) idx += x >= cumheights[k];
+            idx += x >= cumheights[num_bins] + eps;
+            idx = std::min(std::max(idx, 0), num_bins - 1);
+
+            const float input_cumwidths = cumwidths[idx];
+            const float input_bin_widths = cumwidths[idx + 1] - cumwidths[idx];
+            const float input_cumheights = cumheights[idx];
+            const float input_heights = cumheights[idx + 1] - cumheights[idx];
+            const float input_delta = input_heights / input_bin_widths;
+            const float input_derivatives = derivative(ud, idx, num_bins, constant) +
+                                            min_derivative;
+            const float input_derivatives_plus_one = derivative(ud, idx + 1, num_bins, constant) +
+                                                     min_derivative;
+
+            const float shifted = x - input_cumheights;
+            const float slope = input_derivatives + input_derivatives_plus_one - 2 * input_delta;
+            const float a = shifted * slope + input_heights * (input_delta - input_derivatives);
+            const float b = input_heights * input_derivatives - shifted * slope;
+            const float c = -input_delta * shifted;
+            const float discriminant = b * b - 4 * a * c;
+            const float root = (-2 * c) / (b + sqrt(discriminant));
+
+            top_blob.channel(q)[j] = root * input_bin_widths + input_cumwidths;
         }
-        Mat cumheights = cumsum(heights, opt);
-        cumheights = pad(cumheights, 0, 0, 1, 0, 0, opt);
-#pragma omp parallel for num_threads(opt.num_threads)
-        for (int i = 0; i < cumheights.c; i++) {
-            float *cum_h_ptr = cumheights.channel(i);
-            for (int j = 0; j < cumheights.h * cumheights.w; j++) {
-                cum_h_ptr[j] = (top - bottom) * cum_h_ptr[j] + bottom;
-            }
-        }
-        set_column_value(cumheights, 0, bottom, opt);
-        set_column_value(cumheights, -1, top, opt);
+        return 0;
+    }
 
-#pragma omp parallel for num_threads(opt.num_threads)
-        for (int i = 0; i < heights.c; i++) {
-            float *heights_ptr = heights.channel(i);
-            float *cumheights_ptr = cumheights.channel(i);
-            for (int j = 0; j < heights.h; j++) {
-                for (int k = 0; k < heights.w; k++) {
-                    heights_ptr[k] = cumheights_ptr[k + 1] - cumheights_ptr[k];
-                }
-                heights_ptr += heights.w;
-                cumheights_ptr += cumheights.w;
-            }
+private:
+    static const int max_bins = 64;
+
+    // softmax of one row, floored at min_bin, accumulated and mapped onto [lower, upper]
+    static void bin_edges(const float *unnormalized, int num_bins, float min_bin, float lower,
+                          float upper, float *edges) {
+        float max = -FLT_MAX;
+        for (int k = 0; k < num_bins; k++) max = std::max(max, unnormalized[k]);
+        float e[max_bins];
+        float sum = 0.f;
+        for (int k = 0; k < num_bins; k++) {
+            e[k] = exp(unnormalized[k] - max);
+            sum += e[k];
         }
-        Mat bin_idx = searchsorted(cumheights, inputs, opt);
-
-        Mat input_cumwidths = gather(cumwidths, bin_idx, opt);
-
-        Mat input_bin_widths = gather(widths, bin_idx, opt);
-
-        Mat input_cumheights = gather(cumheights, bin_idx, opt);
-
-        Mat delta = matdiv(heights, widths, opt);
-
-        Mat input_delta = gather(delta, bin_idx, opt);
-
-        Mat input_derivatives = gather(derivatives, bin_idx, opt);
-
-        Mat derivatives_plus_one;
-        derivatives_plus_one.create(derivatives.w - 1, derivatives.h, 1);
-
-#pragma omp parallel for num_threads(opt.num_threads)
-        for (int i = 0; i < derivatives.c; i++) {
-            float *d_ptr = derivatives.channel(i);
-            float *d_pl_ptr = derivatives_plus_one.channel(i);
-            for (int j = 0; j < derivatives.h; j++) {
-                for (int k = 0; k < derivatives.w - 1; k++) {
-                    d_pl_ptr[k] = d_ptr[k + 1];
-                }
-                d_ptr += derivatives.w;
-                d_pl_ptr += derivatives_plus_one.w;
-            }
+        const float scale = (1 - min_bin * num_bins) / sum;
+        float cum = 0.f;
+        edges[0] = lower;
+        for (int k = 0; k < num_bins; k++) {
+            cum += min_bin + scale * e[k];
+            edges[k + 1] = (upper - lower) * cum + lower;
         }
-        Mat input_derivatives_plus_one = gather(derivatives_plus_one, bin_idx, opt);
-
-        Mat input_heights = gather(heights, bin_idx, opt);
-
-        Mat inputs_ = inputs.clone();
-
-        Mat a1 = matminus(inputs_, input_cumheights, opt);
-        Mat a2 = matplus(input_derivatives, input_derivatives_plus_one, opt);
-        Mat a3 = product(input_delta, 2, opt);
-        Mat a4 = matminus(a2, a3, opt);
-        Mat a5 = matproduct(a1, a4, opt);
-
-        Mat a6 = matminus(input_delta, input_derivatives, opt);
-        Mat a7 = matproduct(input_heights, a6, opt);
-
-        Mat a = matplus(a5, a7, opt);
-
-        Mat b1 = matproduct(input_heights, input_derivatives, opt);
-
-        Mat b2 = matminus(inputs_, input_cumheights, opt);
-
-        Mat b3 = matplus(input_derivatives, input_derivatives_plus_one, opt);
-        Mat b4 = product(input_delta, 2, opt);
-
-        Mat b5 = matminus(b3, b4, opt);
-
-        Mat b6 = matproduct(b2, b5, opt);
-
-        Mat b = matminus(b1, b6, opt);
-
-        Mat c1 = matminus(input_cumheights, inputs_, opt);
-        Mat c = matproduct(input_delta, c1, opt);
-
-        Mat discriminant1 = matpow(b, 2, opt);
-
-        Mat discriminant2 = matproduct(a, c, opt);
-        Mat discriminant3 = product(discriminant2, 4, opt);
-
-        Mat discriminant = matminus(discriminant1, discriminant3, opt);
-
-        Mat root1 = product(c, -2, opt);
-
-        Mat root2 = matsqrt(discriminant, opt);
-        Mat root3 = matplus(b, root2, opt);
-
-        Mat root = matdiv(root1, root3, opt);
-
-        Mat outputs1 = matproduct(root, input_bin_widths, opt);
-        top_blob = matplus(outputs1, input_cumwidths, opt);
-        if (top_blob.empty()) return -100;
+        edges[num_bins] = upper;
+    }
 
-        return 0;
+    // softplus of the unnormalized derivative, the outer two are pinned so that softplus gives 1
+    static float derivative(const float *unnormalized, int k, int num_bins, float constant) {
+        float v = (k == 0 || k == num_bins) ? constant : unnormalized[k];
+        return v > 20.f ? v : log1p(exp(v));
     }
 };
 
@@ -305,9 +223,7 @@ public:
             const Mat &_x_mask = reducedims(bottom_blobs[0]);
 
             auto x_mask = expand(_x_mask, _stats.w, _stats.h, opt);
-            auto stats = matproduct(_stats, x_mask, opt);
-            auto x1 = matminus(_x1, stats, opt);
-            x1 = matproduct(x1, x_mask, opt);
+            auto x1 = expr::eval((_x1 - expr::ref(_stats) * x_mask) * x_mask, opt);
             top_blob = expanddims(concat(_x0, x1, opt));
         } else {
             const Mat &_x0 = reducedims(bottom_blobs[3]);
@@ -348,12 +264,23 @@ public:
         const Mat &x_length = bottom_blobs[1];
 
         Mat &top_blob = top_blobs[0];
-        top_blob = sequence_mask(x_length, opt);
+        if (x_length.w > 1 && x_length.w == x.w) {
+            // packed sentences pass the mask itself, zeros in the gaps between them
+            top_blob = x_length.reshape(x.w, 1).clone(opt.blob_allocator);
+        } else {
+            top_blob = sequence_mask(x_length, opt);
+        }
+        if (top_blob.empty()) return -100;
 
         return 0;
     }
 };
 
+// relative position multi head attention of the text encoder, fused per head: one score matrix
+// from sgemm, then per row the relative key bias, mask and softmax in place, then the values and
+// the relative values. The heads share emb_rel_k / emb_rel_v, positions farther apart than
+// window_size get no relative term. A position only attends to the run of
+// unmasked positions it belongs to, so sentences packed with masked gaps stay independent
 class Attention : public Layer {
 private:
     int n_heads = 2;
@@ -364,54 +291,101 @@ public:
 
     virtual int forward(const std::vector<Mat> &bottom_blobs, std::vector<Mat> &top_blobs,
                         const Option &opt) const {
-        const Mat &query_ = bottom_blobs[4];
-        const Mat &key_ = bottom_blobs[3];
-        const Mat &value_ = bottom_blobs[5];
+        const Mat &query = bottom_blobs[4];
+        const Mat &key = bottom_blobs[3];
+        const Mat &value = bottom_blobs[5];
         const Mat &attn_mask = bottom_blobs[2];
         const Mat &emb_rel_k = bottom_blobs[0];
         const Mat &emb_rel_v = bottom_blobs[1];
 
-        Mat attn_mask_t = mattranspose(attn_mask, opt);
-
-        Mat mask = matmul(attn_mask_t, attn_mask, opt);
+        const int t_t = query.w;
+        const int t_s = key.w;
+        const int d = key.h;
+        if (t_t != t_s || d != n_heads * k_channels) return -100;
+        if (emb_rel_k.w != k_channels || emb_rel_k.h < 2 * window_size + 1) return -100;
+        if (emb_rel_v.w != k_channels || emb_rel_v.h < 2 * window_size + 1) return -100;
 
-        int t_t = query_.w;
-        int t_s = key_.w;
-        int d = key_.h;
+        const float scale = 1.f / sqrt(float(k_channels));
+        const float *mask = attn_mask;
 
-        Mat query = query_.reshape(t_t, k_channels, n_heads);
-        query = mattranspose(query, opt);
-
-        Mat key = key_.reshape(t_t, k_channels, n_heads);
-        key = mattranspose(key, opt);
-
-        Mat value = value_.reshape(t_t, k_channels, n_heads);
-        value = mattranspose(value, opt);
-
-        Mat scores = matmul(div(query, sqrt(k_channels), opt), mattranspose(key, opt), opt);
-
-        Mat key_relative_embeddings = get_relative_embeddings(emb_rel_k, t_s, window_size, opt);
+        // bounds of the unmasked run around every position, a single sentence is one run
+        std::vector<int> run_lo(t_s), run_hi(t_s);
+        for (int j = 0; j < t_s; j++) {
+            run_lo[j] = (j > 0 && mask[j] != 0 && mask[j - 1] != 0) ? run_lo[j - 1] : j;
+        }
+        for (int j = t_s - 1; j >= 0; j--) {
+            run_hi[j] = (j + 1 < t_s && mask[j] != 0 && mask[j + 1] != 0) ? run_hi[j + 1] : j;
+        }
 
-        Mat rel_logits = matmul_with_relative_keys(div(query, sqrt(k_channels), opt),
-                                                    key_relative_embeddings, opt);
+        Mat &top_blob = top_blobs[0];
+        top_blob.create(t_t, d, (size_t) 4u, opt.blob_allocator);
+        Mat q((int) k_channels, t_t, (size_t) 4u, opt.workspace_allocator);
+        Mat v((int) k_channels, t_s, (size_t) 4u, opt.workspace_allocator);
+        Mat scores(t_s, t_t, (size_t) 4u, opt.workspace_allocator);
+        Mat output((int) k_channels, t_t, (size_t) 4u, opt.workspace_allocator);
+        if (top_blob.empty() || q.empty() || v.empty() || scores.empty() || output.empty())
+            return -100;
+
+        for (int h = 0; h < n_heads; h++) {
+            const int offset = h * k_channels;
+            // time major query (pre-scaled) and value rows, the key rows of this head are
+            // already the transposed key
+#pragma omp parallel for num_threads(opt.num_threads)
+            for (int t = 0; t < t_t; t++) {
+                float *q_row = q.row(t);
+                float *v_row = v.row(t);
+                for (int k = 0; k < k_channels; k++) {
+                    q_row[k] = query.row(offset + k)[t] * scale;
+                    v_row[k] = value.row(offset + k)[t];
+                }
+            }
 
-        Mat scores_local = relative_position_to_absolute_position(rel_logits, opt);
+            sgemm(t_t, t_s, k_channels, q, k_channels, key.row(offset), t_s, scores, t_s, opt);
 
-        scores = matplus(scores, scores_local, opt);
+#pragma omp parallel for num_threads(opt.num_threads)
+            for (int i = 0; i < t_t; i++) {
+                float *row = scores.row(i);
+                const float *q_row = q.row(i);
+                int lo = std::max(i - window_size, 0);
+                int hi = std::min(i + window_size, t_s - 1);
+                for (int j = lo; j <= hi; j++) {
+                    row[j] += sdot(k_channels, q_row, emb_rel_k.row(j - i + window_size));
+                }
+                float max = -FLT_MAX;
+                for (int j = 0; j < t_s; j++) {
+                    if (mask[i] == 0 || mask[j] == 0) row[j] = -1e4f;
+                    else if (j < run_lo[i] || j > run_hi[i]) row[j] = -1e4f;
+                    max = std::max(max, row[j]);
+                }
+                float sum = 0.f;
+                for (int j = 0; j < t_s; j++) {
+                    row[j] = exp(row[j] - max);
+                    sum += row[j];
+                }
+                const float inv = 1.f / sum;
+                for (int j = 0; j < t_s; j++) row[j] *= inv;
+            }
 
-        mask_fill(scores, mask, "=", 0, -1e4, opt);
+            sgemm(t_t, k_channels, t_s, scores, t_s, v, k_channels, output, k_channels, opt);
 
-        Mat p_attn = softmax(scores, opt);
+#pragma omp parallel for num_threads(opt.num_threads)
+            for (int i = 0; i < t_t; i++) {
+                const float *p_attn = scores.row(i);
+                float *out_row = output.row(i);
+                int lo = std::max(i - window_size, 0);
+                int hi = std::min(i + window_size, t_s - 1);
+                for (int j = lo; j <= hi; j++) {
+                    saxpy(k_channels, p_attn[j], emb_rel_v.row(j - i + window_size), out_row);
+                }
+            }
 
-        Mat output = matmul(p_attn, value, opt);
-        Mat relative_weights = absolute_position_to_relative_position(p_attn, opt);
-        Mat value_relative_embeddings = get_relative_embeddings(emb_rel_v, t_s, window_size, opt);
-        output = matplus(output,
-                         matmul_with_relative_values(relative_weights, value_relative_embeddings,
-                                                      opt), opt);
-        output = mattranspose(output, opt);
-        Mat &top_blob = top_blobs[0];
-        top_blob = output.reshape(t_t, d);
+            // back to channel major, rows offset .. offset + k_channels of the output
+#pragma omp parallel for num_threads(opt.num_threads)
+            for (int k = 0; k < k_channels; k++) {
+                float *out = top_blob.row(offset + k);
+                for (int t = 0; t < t_t; t++) out[t] = output.row(t)[k];
+            }
+        }
         return 0;
     }
 };
@@ -459,7 +433,7 @@ public:
         int pad_r = kernel_size / 2;
         Mat padded = pad(bottom_blob, 0, 0, pad_l, pad_r, 0, opt);
         Mat reduced_padded = padded.reshape(padded.w, padded.h);
-        top_blob = reduced_padded.clone();
+        top_blob = reduced_padded.clone(opt.blob_allocator);
         return 0;
     }
 };
@@ -0,0 +1,189 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <cmath>
+#include <type_traits>
+#include "mat.h"
+#include "option.h"
+
+using namespace ncnn;
+
+// elementwise expression templates over Mat, a chain like
+//     expr::eval(m_p + expr::exp(logs_p) * noise * noise_scale, opt)
+// is evaluated in a single pass into one output Mat, without a temporary per operator.
+// All Mat operands must have the shape of the first one, like the helpers of utils.h
+namespace expr {
+
+    // every node exposes channel(q), a cheap cursor with operator[](j) over the w * h elements
+    // of channel q, and shape(), the Mat the result is shaped like or nullptr for a scalar
+
+    struct Ref {
+        typedef void expr_tag;
+        Mat m;
+
+        struct Cursor {
+            const float *p;
+
+            float operator[](int j) const { return p[j]; }
+        };
+
+        Cursor channel(int q) const { return {(const float *) m.channel(q)}; }
+
+        const Mat *shape() const { return &m; }
+    };
+
+    struct Scalar {
+        typedef void expr_tag;
+        float v;
+
+        struct Cursor {
+            float v;
+
+            float operator[](int) const { return v; }
+        };
+
+        Cursor channel(int) const { return {v}; }
+
+        const Mat *shape() const { return nullptr; }
+    };
+
+    template<typename Op, typename L, typename R>
+    struct Binary {
+        typedef void expr_tag;
+        L l;
+        R r;
+
+        struct Cursor {
+            typename L::Cursor l;
+            typename R::Cursor r;
+
+            float operator[](int j) const { return Op::apply(l[j], r[j]); }
+        };
+
+        Cursor channel(int q) const { return {l.channel(q), r.channel(q)}; }
+
+        const Mat *shape() const { return l.shape() ? l.shape() : r.shape(); }
+    };
+
+    template<typename Op, typename A>
+    struct Unary {
+        typedef void expr_tag;
+        A a;
+
+        struct Cursor {
+            typename A::Cursor a;
+
+            float operator[](int j) const { return Op::apply(a[j]); }
+        };
+
+        Cursor channel(int q) const { return {a.channel(q)}; }
+
+        const Mat *shape() const { return a.shape(); }
+    };
+
+    struct AddOp {
+        static float apply(float a, float b) { return a + b; }
+    };
+    struct SubOp {
+        static float apply(float a, float b) { return a - b; }
+    };
+    struct MulOp {
+        static float apply(float a, float b) { return a * b; }
+    };
+    struct DivOp {
+        static float apply(float a, float b) { return a / b; }
+    };
+    struct PowOp {
+        static float apply(float a, float b) { return b == 2.f ? a * a : std::pow(a, b); }
+    };
+    struct ExpOp {
+        static float apply(float a) { return std::exp(a); }
+    };
+    struct SqrtOp {
+        static float apply(float a) { return std::sqrt(a); }
+    };
+    struct NegOp {
+        static float apply(float a) { return -a; }
+    };
+
+    template<typename T, typename = void>
+    struct is_expr : std::false_type {
+    };
+    template<typename T>
+    struct is_expr<T, typename T::expr_tag> : std::true_type {
+    };
+
+    // Mat and float operands are wrapped, expression nodes pass through
+    inline Ref wrap(const Mat &m) { return {m}; }
+
+    inline Scalar wrap(float v) { return {v}; }
+
+    template<typename E>
+    inline typename std::enable_if<is_expr<E>::value, E>::type wrap(const E &e) { return e; }
+
+    template<typename T>
+    struct node {
+        typedef decltype(wrap(std::declval<T>())) type;
+    };
+
+    // at least one side must already be an expression, Mat + Mat stays untouched
+    template<typename L, typename R>
+    struct enable_binary : std::enable_if<is_expr<L>::value || is_expr<R>::value> {
+    };
+
+    inline Ref ref(const Mat &m) { return {m}; }
+
+#define EXPR_BINARY_OPERATOR(op, Op)                                                             \
+    template<typename L, typename R, typename = typename enable_binary<L, R>::type>              \
+    inline Binary<Op, typename node<L>::type, typename node<R>::type>                            \
+    operator op(const L &l, const R &r) {                                                        \
+        return {wrap(l), wrap(r)};                                                               \
+    }
+
+    EXPR_BINARY_OPERATOR(+, AddOp)
+    EXPR_BINARY_OPERATOR(-, SubOp)
+    EXPR_BINARY_OPERATOR(*, MulOp)
+    EXPR_BINARY_OPERATOR(/, DivOp)
+
+#undef EXPR_BINARY_OPERATOR
+
+    template<typename A, typename = typename std::enable_if<is_expr<A>::value>::type>
+    inline Unary<NegOp, A> operator-(const A &a) { return {a}; }
+
+    template<typename A>
+    inline Unary<ExpOp, typename node<A>::type> exp(const A &a) { return {wrap(a)}; }
+
+    template<typename A>
+    inline Unary<SqrtOp, typename node<A>::type> sqrt(const A &a) { return {wrap(a)}; }
+
+    template<typename A>
+    inline Binary<PowOp, typename node<A>::type, Scalar> pow(const A &a, float value) {
+        return {wrap(a), {value}};
+    }
+
+    // evaluates e into out, which may alias one of the operands since every element is read
+    // before it is written
+    template<typename E>
+    inline void eval_into(Mat &out, const E &e, const Option &opt) {
+        int size = out.w * out.h;
+#pragma omp parallel for num_threads(opt.num_threads)
+        for (int q = 0; q < out.c; q++) {
+            typename E::Cursor cursor = e.channel(q);
+            float *p = out.channel(q);
+            for (int j = 0; j < size; j++) p[j] = cursor[j];
+        }
+    }
+
+    template<typename E>
+    inline Mat eval(const E &e, const Option &opt) {
+        const Mat *shape = e.shape();
+        if (shape == nullptr || shape->empty()) return {};
+        Mat res;
+        res.create_like(*shape, opt.blob_allocator);
+        if (res.empty()) return res;
+        eval_into(res, e, opt);
+        return res;
+    }
+}
+
+#endif
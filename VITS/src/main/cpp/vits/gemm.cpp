@@ -0,0 +1,217 @@
+#include "gemm.h"
+#include <algorithm>
+#include "mat.h"
+
+#if __ARM_NEON
+#include <arm_neon.h>
+#elif __AVX__ || __SSE2__
+#include <immintrin.h>
+#endif
+
+// register block of the micro kernel, MR rows of A times NR packed columns of B
+#define GEMM_MR 4
+#define GEMM_NR 8
+
+// copy B into column panels of NR floats per row of k, zero padded on the right edge
+static void pack_b(int n, int k, const float *B, int ldb, float *packed, const Option &opt) {
+    int panels = (n + GEMM_NR - 1) / GEMM_NR;
+#pragma omp parallel for num_threads(opt.num_threads)
+    for (int p = 0; p < panels; p++) {
+        int col = p * GEMM_NR;
+        int cols = std::min(GEMM_NR, n - col);
+        float *out = packed + (size_t) p * k * GEMM_NR;
+        for (int i = 0; i < k; i++) {
+            const float *row = B + (size_t) i * ldb + col;
+            int j = 0;
+            for (; j < cols; j++) out[j] = row[j];
+            for (; j < GEMM_NR; j++) out[j] = 0.f;
+            out += GEMM_NR;
+        }
+    }
+}
+
+// acc[MR][NR] = rows of A (mr of them valid) times one packed panel
+static inline void kernel_4x8(int k, const float *A, int lda, int mr, const float *panel,
+                              float *acc) {
+    const float *a0 = A;
+    const float *a1 = mr > 1 ? A + lda : A;
+    const float *a2 = mr > 2 ? A + 2 * lda : A;
+    const float *a3 = mr > 3 ? A + 3 * lda : A;
+#if __ARM_NEON
+    float32x4_t c00 = vdupq_n_f32(0.f), c01 = vdupq_n_f32(0.f);
+    float32x4_t c10 = vdupq_n_f32(0.f), c11 = vdupq_n_f32(0.f);
+    float32x4_t c20 = vdupq_n_f32(0.f), c21 = vdupq_n_f32(0.f);
+    float32x4_t c30 = vdupq_n_f32(0.f), c31 = vdupq_n_f32(0.f);
+    for (int p = 0; p < k; p++) {
+        float32x4_t b0 = vld1q_f32(panel);
+        float32x4_t b1 = vld1q_f32(panel + 4);
+        c00 = vmlaq_n_f32(c00, b0, a0[p]);
+        c01 = vmlaq_n_f32(c01, b1, a0[p]);
+        c10 = vmlaq_n_f32(c10, b0, a1[p]);
+        c11 = vmlaq_n_f32(c11, b1, a1[p]);
+        c20 = vmlaq_n_f32(c20, b0, a2[p]);
+        c21 = vmlaq_n_f32(c21, b1, a2[p]);
+        c30 = vmlaq_n_f32(c30, b0, a3[p]);
+        c31 = vmlaq_n_f32(c31, b1, a3[p]);
+        panel += GEMM_NR;
+    }
+    vst1q_f32(acc, c00);
+    vst1q_f32(acc + 4, c01);
+    vst1q_f32(acc + 8, c10);
+    vst1q_f32(acc + 12, c11);
+    vst1q_f32(acc + 16, c20);
+    vst1q_f32(acc + 20, c21);
+    vst1q_f32(acc + 24, c30);
+    vst1q_f32(acc + 28, c31);
+#elif __AVX__
+    __m256 c0 = _mm256_setzero_ps(), c1 = _mm256_setzero_ps();
+    __m256 c2 = _mm256_setzero_ps(), c3 = _mm256_setzero_ps();
+    for (int p = 0; p < k; p++) {
+        __m256 b = _mm256_loadu_ps(panel);
+#if __FMA__
+        c0 = _mm256_fmadd_ps(_mm256_set1_ps(a0[p]), b, c0);
+        c1 = _mm256_fmadd_ps(_mm256_set1_ps(a1[p]), b, c1);
+        c2 = _mm256_fmadd_ps(_mm256_set1_ps(a2[p]), b, c2);
+        c3 = _mm256_fmadd_ps(_mm256_set1_ps(a3[p]), b, c3);
+#else
+        c0 = _mm256_add_ps(c0, _mm256_mul_ps(_mm256_set1_ps(a0[p]), b));
+        c1 = _mm256_add_ps(c1, _mm256_mul_ps(_mm256_set1_ps(a1[p]), b));
+        c2 = _mm256_add_ps(c2, _mm256_mul_ps(_mm256_set1_ps(a2[p]), b));
+        c3 = _mm256_add_ps(c3, _mm256_mul_ps(_mm256_set1_ps(a3[p]), b));
+#endif
+        panel += GEMM_NR;
+    }
+    _mm256_storeu_ps(acc, c0);
+    _mm256_storeu_ps(acc + 8, c1);
+    _mm256_storeu_ps(acc + 16, c2);
+    _mm256_storeu_ps(acc + 24, c3);
+#elif __SSE2__
+    __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+    __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+    __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+    __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+    for (int p = 0; p < k; p++) {
+        __m128 b0 = _mm_loadu_ps(panel);
+        __m128 b1 = _mm_loadu_ps(panel + 4);
+        __m128 v0 = _mm_set1_ps(a0[p]);
+        __m128 v1 = _mm_set1_ps(a1[p]);
+        __m128 v2 = _mm_set1_ps(a2[p]);
+        __m128 v3 = _mm_set1_ps(a3[p]);
+        c00 = _mm_add_ps(c00, _mm_mul_ps(v0, b0));
+        c01 = _mm_add_ps(c01, _mm_mul_ps(v0, b1));
+        c10 = _mm_add_ps(c10, _mm_mul_ps(v1, b0));
+        c11 = _mm_add_ps(c11, _mm_mul_ps(v1, b1));
+        c20 = _mm_add_ps(c20, _mm_mul_ps(v2, b0));
+        c21 = _mm_add_ps(c21, _mm_mul_ps(v2, b1));
+        c30 = _mm_add_ps(c30, _mm_mul_ps(v3, b0));
+        c31 = _mm_add_ps(c31, _mm_mul_ps(v3, b1));
+        panel += GEMM_NR;
+    }
+    _mm_storeu_ps(acc, c00);
+    _mm_storeu_ps(acc + 4, c01);
+    _mm_storeu_ps(acc + 8, c10);
+    _mm_storeu_ps(acc + 12, c11);
+    _mm_storeu_ps(acc + 16, c20);
+    _mm_storeu_ps(acc + 20, c21);
+    _mm_storeu_ps(acc + 24, c30);
+    _mm_storeu_ps(acc + 28, c31);
+#else
+    for (int i = 0; i < GEMM_MR * GEMM_NR; i++) acc[i] = 0.f;
+    for (int p = 0; p < k; p++) {
+        float v0 = a0[p], v1 = a1[p], v2 = a2[p], v3 = a3[p];
+        for (int j = 0; j < GEMM_NR; j++) {
+            acc[j] += v0 * panel[j];
+            acc[GEMM_NR + j] += v1 * panel[j];
+            acc[2 * GEMM_NR + j] += v2 * panel[j];
+            acc[3 * GEMM_NR + j] += v3 * panel[j];
+        }
+        panel += GEMM_NR;
+    }
+#endif
+}
+
+void sgemm(int m, int n, int k, const float *A, int lda, const float *B, int ldb, float *C,
+           int ldc, const Option &opt) {
+    if (m <= 0 || n <= 0) return;
+    if (k <= 0) {
+        for (int i = 0; i < m; i++) std::fill(C + (size_t) i * ldc, C + (size_t) i * ldc + n, 0.f);
+        return;
+    }
+
+    int panels = (n + GEMM_NR - 1) / GEMM_NR;
+    Mat packed((int) ((size_t) panels * k * GEMM_NR), (size_t) 4u, opt.workspace_allocator);
+    if (packed.empty()) return;
+    pack_b(n, k, B, ldb, packed, opt);
+
+    int row_blocks = (m + GEMM_MR - 1) / GEMM_MR;
+#pragma omp parallel for num_threads(opt.num_threads)
+    for (int rb = 0; rb < row_blocks; rb++) {
+        int row = rb * GEMM_MR;
+        int mr = std::min(GEMM_MR, m - row);
+        const float *a = A + (size_t) row * lda;
+        float acc[GEMM_MR * GEMM_NR];
+        for (int p = 0; p < panels; p++) {
+            const float *panel = (const float *) packed + (size_t) p * k * GEMM_NR;
+            kernel_4x8(k, a, lda, mr, panel, acc);
+            int col = p * GEMM_NR;
+            int nr = std::min(GEMM_NR, n - col);
+            for (int i = 0; i < mr; i++) {
+                float *c = C + (size_t) (row + i) * ldc + col;
+                for (int j = 0; j < nr; j++) c[j] = acc[i * GEMM_NR + j];
+            }
+        }
+    }
+}
+
+float sdot(int n, const float *x, const float *y) {
+    int i = 0;
+    float sum = 0.f;
+#if __ARM_NEON
+    float32x4_t acc0 = vdupq_n_f32(0.f), acc1 = vdupq_n_f32(0.f);
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(x + i), vld1q_f32(y + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(x + i + 4), vld1q_f32(y + i + 4));
+    }
+    float part[4];
+    vst1q_f32(part, vaddq_f32(acc0, acc1));
+    sum = part[0] + part[1] + part[2] + part[3];
+#elif __AVX__
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+    float part[8];
+    _mm256_storeu_ps(part, acc);
+    sum = part[0] + part[1] + part[2] + part[3] + part[4] + part[5] + part[6] + part[7];
+#elif __SSE2__
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4)));
+    }
+    float part[4];
+    _mm_storeu_ps(part, _mm_add_ps(acc0, acc1));
+    sum = part[0] + part[1] + part[2] + part[3];
+#endif
+    for (; i < n; i++) sum += x[i] * y[i];
+    return sum;
+}
+
+void saxpy(int n, float a, const float *x, float *y) {
+    int i = 0;
+#if __ARM_NEON
+    for (; i + 4 <= n; i += 4) vst1q_f32(y + i, vmlaq_n_f32(vld1q_f32(y + i), vld1q_f32(x + i), a));
+#elif __AVX__
+    __m256 va = _mm256_set1_ps(a);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i),
+                                              _mm256_mul_ps(va, _mm256_loadu_ps(x + i))));
+    }
+#elif __SSE2__
+    __m128 va = _mm_set1_ps(a);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+    }
+#endif
+    for (; i < n; i++) y[i] += a * x[i];
+}
@@ -0,0 +1,20 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "option.h"
+
+using namespace ncnn;
+
+// C = A * B for row major matrices, A is m x k, B is k x n and C is m x n, lda / ldb / ldc are
+// the row strides in floats. B is packed into panels of 8 columns and multiplied 4 rows at a
+// time with NEON / AVX / SSE micro kernels when available, threads split the rows of C
+void sgemm(int m, int n, int k, const float *A, int lda, const float *B, int ldb, float *C,
+           int ldc, const Option &opt);
+
+// sum of x[i] * y[i] over n elements
+float sdot(int n, const float *x, const float *y);
+
+// y[i] += a * x[i] over n elements
+void saxpy(int n, float a, const float *x, float *y);
+
+#endif
@@ -0,0 +1,33 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool MappedFile::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps its own reference to the file
+    ::close(fd);
+    if (mapped == MAP_FAILED) return false;
+    addr = mapped;
+    length = size_t(st.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (addr != nullptr) munmap(addr, length);
+    addr = nullptr;
+    length = 0;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// read only, private mapping of a whole file. The pages are shared with the page cache, so
+// weights referenced from the mapping cost no anonymous memory and the kernel may drop cold ones
+class MappedFile {
+private:
+    void *addr = nullptr;
+    size_t length = 0;
+
+    MappedFile(const MappedFile &);
+
+    MappedFile &operator=(const MappedFile &);
+
+public:
+    MappedFile() = default;
+
+    ~MappedFile();
+
+    bool open(const std::string &path);
+
+    void close();
+
+    // page aligned, valid until close()
+    const unsigned char *data() const { return (const unsigned char *) addr; }
+
+    size_t size() const { return length; }
+};
+
+#endif
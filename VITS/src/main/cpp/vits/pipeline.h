@@ -0,0 +1,53 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// fixed capacity fifo between two pipeline stages, push blocks while the consumer is behind and
+// pop blocks while the producer is. close() wakes both sides: pending items can still be popped,
+// further pushes are refused
+template<typename T>
+class BoundedQueue {
+private:
+    std::mutex lock;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    // false when the queue was closed, the item is dropped
+    bool push(T item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    // false once the queue is closed and drained
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [this] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "random.h"
+#include <cmath>
+#include <random>
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define TWO_PI 6.28318530717958647692f
+
+// per thread position in the noise stream
+struct NoiseStream {
+    uint64_t seed = 0;
+    uint64_t offset = 0;
+    bool seeded = false;
+};
+
+static thread_local NoiseStream current_stream;
+
+static inline void philox_round(uint32_t ctr[4], const uint32_t key[2]) {
+    uint64_t p0 = (uint64_t) PHILOX_M0 * ctr[0];
+    uint64_t p1 = (uint64_t) PHILOX_M1 * ctr[2];
+    uint32_t hi0 = uint32_t(p0 >> 32), lo0 = uint32_t(p0);
+    uint32_t hi1 = uint32_t(p1 >> 32), lo1 = uint32_t(p1);
+    uint32_t c0 = hi1 ^ ctr[1] ^ key[0];
+    uint32_t c2 = hi0 ^ ctr[3] ^ key[1];
+    ctr[0] = c0;
+    ctr[1] = lo1;
+    ctr[2] = c2;
+    ctr[3] = lo0;
+}
+
+// four random words for block number block of seed
+static inline void philox4x32_10(uint64_t seed, uint64_t block, uint32_t out[4]) {
+    uint32_t key[2] = {uint32_t(seed), uint32_t(seed >> 32)};
+    out[0] = uint32_t(block);
+    out[1] = uint32_t(block >> 32);
+    out[2] = 0;
+    out[3] = 0;
+    for (int r = 0; r < 10; r++) {
+        philox_round(out, key);
+        key[0] += PHILOX_W0;
+        key[1] += PHILOX_W1;
+    }
+}
+
+// uniform in (0, 1], never 0 so the log below stays finite
+static inline float to_uniform(uint32_t x) {
+    return (float(x >> 8) + 1.f) * (1.f / 16777216.f);
+}
+
+// four gaussian samples from one block, two Box-Muller pairs
+static inline void block_normal(uint64_t seed, uint64_t block, float out[4]) {
+    uint32_t bits[4];
+    philox4x32_10(seed, block, bits);
+    for (int i = 0; i < 4; i += 2) {
+        float r = std::sqrt(-2.f * std::log(to_uniform(bits[i])));
+        float theta = TWO_PI * to_uniform(bits[i + 1]);
+        out[i] = r * std::cos(theta);
+        out[i + 1] = r * std::sin(theta);
+    }
+}
+
+void philox_normal(uint64_t seed, uint64_t offset, float *out, int n, const Option &opt) {
+    if (n <= 0) return;
+    // work in whole blocks, the partial blocks at both ends are cut down afterwards
+    uint64_t first_block = offset / 4;
+    uint64_t last_block = (offset + n - 1) / 4;
+    int blocks = int(last_block - first_block + 1);
+#pragma omp parallel for num_threads(opt.num_threads)
+    for (int b = 0; b < blocks; b++) {
+        float samples[4];
+        block_normal(seed, first_block + b, samples);
+        int64_t base = int64_t((first_block + b) * 4 - offset);
+        for (int k = 0; k < 4; k++) {
+            int64_t i = base + k;
+            if (i >= 0 && i < n) out[i] = samples[k];
+        }
+    }
+}
+
+uint64_t random_seed() {
+    std::random_device device;
+    return (uint64_t(device()) << 32) ^ device();
+}
+
+void stream_normal(float *out, int n, const Option &opt) {
+    NoiseStream &stream = current_stream;
+    if (!stream.seeded) {
+        stream.seed = random_seed();
+        stream.offset = 0;
+        stream.seeded = true;
+    }
+    philox_normal(stream.seed, stream.offset, out, n, opt);
+    // keep every draw block aligned so the Box-Muller pairs are never split between draws
+    stream.offset += (uint64_t(n) + 3) / 4 * 4;
+}
+
+NoiseScope::NoiseScope(int64_t seed) {
+    NoiseStream &stream = current_stream;
+    saved_seed = stream.seed;
+    saved_offset = stream.offset;
+    saved_seeded = stream.seeded;
+    scope_seed = seed < 0 ? random_seed() : uint64_t(seed);
+    stream.seed = scope_seed;
+    stream.offset = 0;
+    stream.seeded = true;
+}
+
+NoiseScope::~NoiseScope() {
+    NoiseStream &stream = current_stream;
+    stream.seed = saved_seed;
+    stream.offset = saved_offset;
+    stream.seeded = saved_seeded;
+}
+
+uint64_t NoiseScope::seed() const {
+    return scope_seed;
+}
@@ -0,0 +1,47 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include "option.h"
+
+using namespace ncnn;
+
+// counter based gaussian noise (Philox4x32-10 + Box-Muller): sample i of a stream only depends on
+// (seed, i), so the noise is the same for any thread count and needs no shared generator state.
+//
+// randn and the RandnLike layer draw from the calling thread's stream, which a NoiseScope sets to
+// a fixed seed for the duration of one synthesis; every draw advances the stream by its size.
+// Outside of a scope each thread draws from a stream with a random seed
+
+// fills out[0, n) with the samples offset .. offset + n - 1 of the stream of seed
+void philox_normal(uint64_t seed, uint64_t offset, float *out, int n, const Option &opt);
+
+// fills out[0, n) from the calling thread's stream and advances it
+void stream_normal(float *out, int n, const Option &opt);
+
+// a seed from std::random_device, for requests that did not ask for a fixed one
+uint64_t random_seed();
+
+// sets the calling thread's stream to the start of seed, a negative seed picks a random one.
+// The previous stream is restored on destruction
+class NoiseScope {
+public:
+    explicit NoiseScope(int64_t seed);
+
+    ~NoiseScope();
+
+    // the seed in effect, useful to reproduce a random request later
+    uint64_t seed() const;
+
+private:
+    uint64_t scope_seed;
+    uint64_t saved_seed;
+    uint64_t saved_offset;
+    bool saved_seeded;
+
+    NoiseScope(const NoiseScope &) = delete;
+
+    NoiseScope &operator=(const NoiseScope &) = delete;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "stft.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#define PI 3.14159265358979323846
+
+RfftPlan::RfftPlan(int n) : n(n), wsave(size_t(2 * n + 15)) {
+    rffti(n, wsave.data());
+}
+
+const RfftPlan &RfftPlan::get(int n) {
+    static std::mutex mutex;
+    static std::map<int, std::unique_ptr<RfftPlan>> plans;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unique_ptr<RfftPlan> &plan = plans[n];
+    if (!plan) plan.reset(new RfftPlan(n));
+    return *plan;
+}
+
+void RfftPlan::forward(fftpack_real *data, fftpack_real *workspace) const {
+    rfftf(n, data, workspace);
+}
+
+// bin k of a packed fftpack spectrum of n samples
+static inline std::complex<fftpack_real> packed_bin(const fftpack_real *packed, int n, int k) {
+    if (k == 0) return {packed[0], 0};
+    if (2 * k == n) return {packed[n - 1], 0};
+    return {packed[2 * k - 1], packed[2 * k]};
+}
+
+std::vector<Mat> rfft(const Mat &m, const Option &opt) {
+    if (m.empty()) return {};
+    Mat real, image;
+    if (m.dims == 2) {
+        real.create(m.w / 2 + 1, m.h, (size_t) 4u, opt.blob_allocator);
+        image.create(m.w / 2 + 1, m.h, (size_t) 4u, opt.blob_allocator);
+    }
+    if (m.dims == 3) {
+        real.create(m.w / 2 + 1, m.h, m.c, (size_t) 4u, opt.blob_allocator);
+        image.create(m.w / 2 + 1, m.h, m.c, (size_t) 4u, opt.blob_allocator);
+    }
+    const RfftPlan &plan = RfftPlan::get(m.w);
+    const int rows = m.c * m.h;
+    const int threads = std::max(std::min(opt.num_threads, rows), 1);
+#pragma omp parallel for num_threads(threads)
+    for (int t = 0; t < threads; t++) {
+        std::vector<fftpack_real> workspace = plan.make_workspace();
+        std::vector<fftpack_real> packed(m.w);
+        for (int r = rows * t / threads; r < rows * (t + 1) / threads; r++) {
+            int i = r / m.h;
+            int j = r % m.h;
+            const float *ptr = m.channel(i).row(j);
+            std::copy(ptr, ptr + m.w, packed.begin());
+            plan.forward(packed.data(), workspace.data());
+            float *real_ptr = real.channel(i).row(j);
+            float *imag_ptr = image.channel(i).row(j);
+            for (int k = 0; k < real.w; k++) {
+                std::complex<fftpack_real> bin = packed_bin(packed.data(), m.w, k);
+                real_ptr[k] = bin.real();
+                imag_ptr[k] = bin.imag();
+            }
+        }
+    }
+    return std::vector<Mat>{real, image};
+}
+
+// number of hop_length spaced frames of filter_length after padding filter_length / 2 per side
+static int stft_frames(const Mat &y, int filter_length, int hop_length) {
+    int padded = y.w * y.h + filter_length / 2 * 2;
+    return (padded - (filter_length - 1) + hop_length - 1) / hop_length;
+}
+
+// centered frames of the zero padded signal, times a symmetric hann window of win_length padded
+// to filter_length, through the cached real fft. Frames are split into one contiguous range per
+// thread, each with its own frame buffer and fft workspace; emit(frame, packed spectrum)
+template<typename Emit>
+static int run_stft(const Mat &y, int filter_length, int hop_length, int win_length,
+                    const Option &opt, Emit &&emit) {
+    const int n = filter_length;
+    const int length = y.w * y.h;
+    const int pad = n / 2;
+    const int frames = stft_frames(y, filter_length, hop_length);
+    if (frames <= 0) return 0;
+
+    std::vector<float> window(size_t(n), 0.f);
+    const int offset = (n - win_length) / 2;
+    for (int j = 0; j < win_length; j++) {
+        window[offset + j] = float(0.5 - 0.5 * cos(2 * PI * j / (float(win_length - 1))));
+    }
+
+    const float *samples = y;
+    const RfftPlan &plan = RfftPlan::get(n);
+    const int threads = std::max(std::min(opt.num_threads, frames), 1);
+#pragma omp parallel for num_threads(threads)
+    for (int t = 0; t < threads; t++) {
+        std::vector<fftpack_real> workspace = plan.make_workspace();
+        std::vector<fftpack_real> buffer(n);
+        for (int f = frames * t / threads; f < frames * (t + 1) / threads; f++) {
+            const int start = f * hop_length - pad;
+            for (int k = 0; k < n; k++) {
+                int index = start + k;
+                buffer[k] = index >= 0 && index < length ? samples[index] * window[k] : 0.f;
+            }
+            plan.forward(buffer.data(), workspace.data());
+            emit(f, buffer.data());
+        }
+    }
+    return frames;
+}
+
+std::vector<Mat>
+stft(const Mat &y, const int filter_length, const int hop_length, const int win_length,
+     const Option &opt) {
+    if (y.empty() || hop_length <= 0 || win_length > filter_length) return {};
+    const int frames = stft_frames(y, filter_length, hop_length);
+    if (frames <= 0) return {};
+    const int bins = filter_length / 2 + 1;
+    Mat real(frames, bins, (size_t) 4u, opt.blob_allocator);
+    Mat imag(frames, bins, (size_t) 4u, opt.blob_allocator);
+    run_stft(y, filter_length, hop_length, win_length, opt,
+             [&](int f, const fftpack_real *packed) {
+                 for (int k = 0; k < bins; k++) {
+                     std::complex<fftpack_real> bin = packed_bin(packed, filter_length, k);
+                     real.row(k)[f] = bin.real();
+                     imag.row(k)[f] = bin.imag();
+                 }
+             });
+    return std::vector<Mat>{real, imag};
+}
+
+Mat stft_magnitude(const Mat &y, const int filter_length, const int hop_length,
+                   const int win_length, const Option &opt, float eps) {
+    if (y.empty() || hop_length <= 0 || win_length > filter_length) return {};
+    const int frames = stft_frames(y, filter_length, hop_length);
+    if (frames <= 0) return {};
+    const int bins = filter_length / 2 + 1;
+    Mat magnitude(frames, bins, (size_t) 4u, opt.blob_allocator);
+    run_stft(y, filter_length, hop_length, win_length, opt,
+             [&](int f, const fftpack_real *packed) {
+                 for (int k = 0; k < bins; k++) {
+                     std::complex<fftpack_real> bin = packed_bin(packed, filter_length, k);
+                     magnitude.row(k)[f] = std::sqrt(bin.real() * bin.real() +
+                                                     bin.imag() * bin.imag() + eps);
+                 }
+             });
+    return magnitude;
+}
@@ -0,0 +1,44 @@
+#ifndef STFT_H
+#define STFT_H
+
+#include <complex>
+#include <vector>
+#include "mat.h"
+#include "option.h"
+#include "../fftpack/fftpack.h"
+
+using namespace ncnn;
+
+// fftpack real fft tables for one transform size, built once and shared by every caller.
+// fftpack uses the first n floats of wsave as scratch, so each thread transforms with its own
+// copy of the tables (make_workspace)
+class RfftPlan {
+public:
+    static const RfftPlan &get(int n);
+
+    int size() const { return n; }
+
+    std::vector<fftpack_real> make_workspace() const { return wsave; }
+
+    // in place forward transform of n samples, fftpack's packed layout
+    // r0, re1, im1, ..., re(n/2) for even n
+    void forward(fftpack_real *data, fftpack_real *workspace) const;
+
+private:
+    explicit RfftPlan(int n);
+
+    int n;
+    std::vector<fftpack_real> wsave;
+};
+
+std::vector<Mat> rfft(const Mat& m, const Option& opt); // rfft for dim 0
+
+// short time Fourier transform, {real, imag} of shape (w = frames, h = filter_length / 2 + 1)
+std::vector<Mat> stft(const Mat& y, const int filter_length, const int hop_length,
+                      const int win_length, const Option& opt);
+
+// sqrt(real^2 + imag^2 + eps) of the same transform without materializing real and imag
+Mat stft_magnitude(const Mat& y, const int filter_length, const int hop_length,
+                   const int win_length, const Option& opt, float eps = 1e-6f);
+
+#endif
@@ -0,0 +1,228 @@
+#include "synthesis_cache.h"
+#include <dirent.h>
+#include <sys/stat.h>
+
+// spill file: magic, key size, key, sample count, fp16 samples
+#define SPILL_MAGIC 0x4D435056u
+#define SPILL_SUFFIX ".vpcm"
+
+static size_t audio_bytes(const Mat &audio) {
+    return audio.total() * audio.elemsize;
+}
+
+// stable across processes, unlike std::hash, so spilled files are found again after a restart
+static std::string spill_file_name(const std::string &key) {
+    uint64_t hash = 1469598103934665603ull;
+    for (unsigned char c: key) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx" SPILL_SUFFIX, (unsigned long long) hash);
+    return name;
+}
+
+std::string SynthesisCache::make_key(const std::string &model, const Mat &x, int sid,
+                                     float noise_scale, float noise_scale_w, float length_scale,
+                                     int64_t seed, int window) {
+    if (seed < 0 || x.empty()) return {};
+    std::string key;
+    auto append = [&key](const void *data, size_t size) {
+        key.append((const char *) data, size);
+    };
+    uint32_t model_size = uint32_t(model.size());
+    append(&model_size, sizeof(model_size));
+    key += model;
+    append(&window, sizeof(window));
+    append(&sid, sizeof(sid));
+    append(&noise_scale, sizeof(noise_scale));
+    append(&noise_scale_w, sizeof(noise_scale_w));
+    append(&length_scale, sizeof(length_scale));
+    append(&seed, sizeof(seed));
+    const float *ids = x;
+    for (int i = 0; i < x.w * x.h; i++) {
+        int32_t id = int32_t(ids[i]);
+        append(&id, sizeof(id));
+    }
+    return key;
+}
+
+void SynthesisCache::configure(size_t budget_bytes_, const std::string &spill_folder_,
+                               size_t spill_budget_bytes_) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        budget_bytes = budget_bytes_;
+        while (bytes > budget_bytes && !entries.empty()) {
+            bytes -= audio_bytes(entries.back().audio);
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+    std::lock_guard<std::mutex> guard(spill_lock);
+    spill_budget_bytes = spill_budget_bytes_;
+    if (spill_folder_ != spill_folder) {
+        spill_folder = spill_folder_;
+        spill_entries.clear();
+        spill_index.clear();
+        spill_bytes = 0;
+        if (!spill_folder.empty()) scan_spill_folder();
+    }
+    trim_spill_folder();
+}
+
+Mat SynthesisCache::find(const std::string &key) {
+    if (key.empty()) return {};
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->audio;
+        }
+    }
+    Mat audio = load_spilled(key);
+    // back in memory, the file stays until the spill budget needs its room
+    if (!audio.empty()) insert(key, audio);
+    return audio;
+}
+
+void SynthesisCache::insert(const std::string &key, const Mat &audio) {
+    if (key.empty() || audio.empty()) return;
+    std::vector<Entry> evicted;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (audio_bytes(audio) > budget_bytes) return;
+        auto it = index.find(key);
+        if (it != index.end()) {
+            bytes -= audio_bytes(it->second->audio);
+            entries.erase(it->second);
+        }
+        entries.push_front({key, audio});
+        index[key] = entries.begin();
+        bytes += audio_bytes(audio);
+        while (bytes > budget_bytes) {
+            bytes -= audio_bytes(entries.back().audio);
+            index.erase(entries.back().key);
+            evicted.push_back(std::move(entries.back()));
+            entries.pop_back();
+        }
+    }
+    if (!evicted.empty()) spill(evicted);
+}
+
+void SynthesisCache::clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+void SynthesisCache::spill(const std::vector<Entry> &evicted) {
+    std::lock_guard<std::mutex> guard(spill_lock);
+    if (spill_folder.empty() || spill_budget_bytes == 0) return;
+    for (const Entry &entry: evicted) {
+        std::string file = spill_file_name(entry.key);
+        FILE *fp = fopen(join_path(spill_folder, file).c_str(), "wb");
+        if (fp == nullptr) {
+            LOGW("cannot spill to %s", spill_folder.c_str());
+            return;
+        }
+        uint32_t header[2] = {SPILL_MAGIC, uint32_t(entry.key.size())};
+        uint32_t samples = uint32_t(entry.audio.w * entry.audio.h);
+        std::vector<unsigned short> half(samples);
+        const float *p = entry.audio;
+        for (uint32_t i = 0; i < samples; i++) half[i] = float32_to_float16(p[i]);
+        bool ok = fwrite(header, sizeof(header), 1, fp) == 1 &&
+                  fwrite(entry.key.data(), 1, entry.key.size(), fp) == entry.key.size() &&
+                  fwrite(&samples, sizeof(samples), 1, fp) == 1 &&
+                  fwrite(half.data(), sizeof(unsigned short), samples, fp) == samples;
+        ok = fclose(fp) == 0 && ok;
+
+        auto it = spill_index.find(file);
+        if (it != spill_index.end()) {
+            spill_bytes -= it->second->bytes;
+            spill_entries.erase(it->second);
+            spill_index.erase(it);
+        }
+        if (!ok) {
+            remove(join_path(spill_folder, file).c_str());
+            continue;
+        }
+        size_t size = sizeof(header) + entry.key.size() + sizeof(samples) +
+                      samples * sizeof(unsigned short);
+        spill_entries.push_front({file, size});
+        spill_index[file] = spill_entries.begin();
+        spill_bytes += size;
+    }
+    trim_spill_folder();
+}
+
+Mat SynthesisCache::load_spilled(const std::string &key) {
+    std::lock_guard<std::mutex> guard(spill_lock);
+    if (spill_folder.empty()) return {};
+    std::string file = spill_file_name(key);
+    auto it = spill_index.find(file);
+    if (it == spill_index.end()) return {};
+    spill_entries.splice(spill_entries.begin(), spill_entries, it->second);
+
+    FILE *fp = fopen(join_path(spill_folder, file).c_str(), "rb");
+    if (fp == nullptr) return {};
+    Mat audio;
+    uint32_t header[2];
+    uint32_t samples = 0;
+    std::string stored;
+    if (fread(header, sizeof(header), 1, fp) == 1 && header[0] == SPILL_MAGIC &&
+        header[1] == key.size()) {
+        stored.resize(header[1]);
+        // a different key with the same hash is a miss
+        if (fread(&stored[0], 1, stored.size(), fp) == stored.size() && stored == key &&
+            fread(&samples, sizeof(samples), 1, fp) == 1 && samples > 0) {
+            std::vector<unsigned short> half(samples);
+            if (fread(half.data(), sizeof(unsigned short), samples, fp) == samples) {
+                audio.create(int(samples));
+                float *p = audio;
+                for (uint32_t i = 0; i < samples; i++) p[i] = float16_to_float32(half[i]);
+            }
+        }
+    }
+    fclose(fp);
+    return audio;
+}
+
+void SynthesisCache::scan_spill_folder() {
+    DIR *dir = opendir(spill_folder.c_str());
+    if (dir == nullptr) {
+        LOGW("spill folder %s not found", spill_folder.c_str());
+        return;
+    }
+    std::vector<std::pair<time_t, SpillEntry>> found;
+    const size_t suffix = strlen(SPILL_SUFFIX);
+    while (struct dirent *ent = readdir(dir)) {
+        std::string file = ent->d_name;
+        if (file.size() <= suffix || file.compare(file.size() - suffix, suffix, SPILL_SUFFIX) != 0)
+            continue;
+        struct stat st{};
+        if (stat(join_path(spill_folder, file).c_str(), &st) != 0) continue;
+        found.push_back({st.st_mtime, {file, size_t(st.st_size)}});
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end(),
+              [](const std::pair<time_t, SpillEntry> &a, const std::pair<time_t, SpillEntry> &b) {
+                  return a.first > b.first;
+              });
+    for (const auto &f: found) {
+        spill_entries.push_back(f.second);
+        spill_index[f.second.file] = std::prev(spill_entries.end());
+        spill_bytes += f.second.bytes;
+    }
+}
+
+void SynthesisCache::trim_spill_folder() {
+    while (spill_bytes > spill_budget_bytes && !spill_entries.empty()) {
+        const SpillEntry &oldest = spill_entries.back();
+        remove(join_path(spill_folder, oldest.file).c_str());
+        spill_bytes -= oldest.bytes;
+        spill_index.erase(oldest.file);
+        spill_entries.pop_back();
+    }
+}
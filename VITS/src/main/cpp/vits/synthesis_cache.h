@@ -0,0 +1,73 @@
+#ifndef SYNTHESIS_CACHE_H
+#define SYNTHESIS_CACHE_H
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "utils.h"
+
+// audio of recent requests keyed by their token ids and every parameter that shapes the output,
+// so a repeated line costs a lookup instead of a forward. Past the memory budget the least
+// recently used entries are dropped, or moved to the spill folder as fp16 when one is set, which
+// has a budget of its own. Only requests with a fixed seed are cacheable: a random seed asks for
+// new audio on every call
+class SynthesisCache {
+private:
+    struct Entry {
+        std::string key;
+        Mat audio;
+    };
+
+    // spilled entry, the file name is derived from the key
+    struct SpillEntry {
+        std::string file;
+        size_t bytes;
+    };
+
+    std::mutex lock;
+    // most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    size_t bytes = 0;
+    size_t budget_bytes = size_t(16) << 20;
+
+    std::mutex spill_lock;
+    std::string spill_folder;
+    size_t spill_budget_bytes = 0;
+    std::list<SpillEntry> spill_entries;
+    std::unordered_map<std::string, std::list<SpillEntry>::iterator> spill_index;
+    size_t spill_bytes = 0;
+
+    void spill(const std::vector<Entry> &evicted);
+
+    Mat load_spilled(const std::string &key);
+
+    // indexes the files a previous process left in the spill folder, oldest first out
+    void scan_spill_folder();
+
+    void trim_spill_folder();
+
+public:
+    // empty for a random (negative) seed, which must not be cached. model is the engine's
+    // SynthesizerTrn::fingerprint(), the spill folder outlives a model switch and the process.
+    // window is 0 for the audio of a whole forward and the chunk_frames of a windowed decode
+    // otherwise: the seams of the windows differ slightly, so the two do not share entries
+    static std::string make_key(const std::string &model, const Mat &x, int sid,
+                                float noise_scale, float noise_scale_w, float length_scale,
+                                int64_t seed, int window);
+
+    // budget_bytes 0 disables the cache, an empty spill_folder the spill
+    void configure(size_t budget_bytes, const std::string &spill_folder,
+                   size_t spill_budget_bytes);
+
+    // the cached audio, shared with the cache and so read only, or an empty Mat
+    Mat find(const std::string &key);
+
+    // audio must not come from a pooled allocator, the cache keeps it beyond the request
+    void insert(const std::string &key, const Mat &audio);
+
+    // drops the entries in memory, spilled ones stay on disk
+    void clear();
+};
+
+#endif
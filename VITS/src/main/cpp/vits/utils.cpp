@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "expr.h"
 
 void pretty_print(const ncnn::Mat &m, const char *name) {
     std::stringstream ss;
@@ -101,7 +102,7 @@ void pretty_print(const ncnn::Mat &m, const char *name) {
 
 Mat softmax(const Mat &m, const Option &opt) {
     if (m.empty()) return m;
-    Mat blob = m.clone();
+    Mat blob = m.clone(opt.blob_allocator);
 
     int w = blob.w;
     int h = blob.h;
@@ -140,7 +141,7 @@ Mat cumsum(const Mat &blob, const Option &opt) {
     int c = blob.c;
 
     Mat res;
-    res.create_like(blob);
+    res.create_like(blob, opt.blob_allocator);
 
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < c; i++) {
@@ -162,10 +163,10 @@ Mat pad(const Mat &blob, int pad_top, int pad_bottom, int pad_left, int pad_righ
     int pad_row = pad_left + pad_right;
     int pad_column = pad_top + pad_bottom;
     if (blob.dims == 2) {
-        res.create(blob.w + pad_row, blob.h + pad_column);
+        res.create(blob.w + pad_row, blob.h + pad_column, (size_t) 4u, opt.blob_allocator);
     }
     if (blob.dims == 3) {
-        res.create(blob.w + pad_row, blob.h + pad_column, blob.c);
+        res.create(blob.w + pad_row, blob.h + pad_column, blob.c, (size_t) 4u, opt.blob_allocator);
     }
     res.fill(pad_value);
 #pragma omp parallel for num_threads(opt.num_threads)
@@ -189,10 +190,10 @@ Mat Slice(const Mat &blob, int top, int bottom, int left, int right, int stride_
     int res_w = ceil(float(right - left) / float(stride_w));
     int res_h = ceil(float(bottom - top) / float(stride_h));
     if (blob.dims == 2) {
-        res.create(res_w, res_h);
+        res.create(res_w, res_h, (size_t) 4u, opt.blob_allocator);
     }
     if (blob.dims == 3) {
-        res.create(res_w, res_h, blob.c);
+        res.create(res_w, res_h, blob.c, (size_t) 4u, opt.blob_allocator);
     }
     if (stride_w == 1) {
 #pragma omp parallel for num_threads(opt.num_threads)
@@ -265,7 +266,7 @@ void set_column_value(Mat &blob, int column, float value, const Option &opt) {
 Mat softplus(const Mat &blob, const Option &opt) {
     if (blob.empty()) return blob;
     Mat res;
-    res.create_like(blob);
+    res.create_like(blob, opt.blob_allocator);
 
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < blob.c; i++) {
@@ -289,14 +290,13 @@ Mat searchsorted(Mat &bin_locations, const Mat &inputs, const Option &opt) {
     for (int i = 0; i < c; i++) {
         float *ptr = bin_locations.channel(i);
         for (int j = 0; j < h; j++) {
-            float v = ptr[w - 1] + eps;
-            ptr[w - 1] = v;
+            ptr[w - 1] += eps;
+            ptr += w;
         }
-        ptr += w;
     }
 
     Mat inputs_ge;
-    inputs_ge.create_like(bin_locations);
+    inputs_ge.create_like(bin_locations, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < c; i++) {
         float *ge_ptr = inputs_ge.channel(i);
@@ -313,7 +313,7 @@ Mat searchsorted(Mat &bin_locations, const Mat &inputs, const Option &opt) {
     }
 
     Mat res;
-    res.create_like(inputs); // 100x1
+    res.create_like(inputs, opt.blob_allocator); // 100x1
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < c; i++) {
         float *res_ptr = res.channel(i);
@@ -334,7 +334,7 @@ Mat searchsorted(Mat &bin_locations, const Mat &inputs, const Option &opt) {
 Mat gather(Mat &blob, Mat &index, const Option &opt) {
     if (blob.empty()) return blob;
     Mat res;
-    res.create_like(index);
+    res.create_like(index, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < blob.c; i++) {
         const float *ptr = blob.channel(i);
@@ -351,117 +351,43 @@ Mat gather(Mat &blob, Mat &index, const Option &opt) {
 
 Mat matplus(const Mat &m1, const Mat &m2, const Option &opt) {
     if (m1.empty() || m2.empty()) return {};
-    Mat res;
-    res.create_like(m1);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p1 = m1.channel(i);
-        const float *p2 = m2.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = p1[j] + p2[j];
-        }
-    }
-    return res;
+    return expr::eval(expr::ref(m1) + m2, opt);
 }
 
 Mat matminus(const Mat &m1, const Mat &m2, const Option &opt) {
     if (m1.empty() || m2.empty()) return {};
-    Mat res;
-    res.create_like(m1);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p1 = m1.channel(i);
-        const float *p2 = m2.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = p1[j] - p2[j];
-        }
-    }
-    return res;
+    return expr::eval(expr::ref(m1) - m2, opt);
 }
 
 Mat matdiv(const Mat &m1, const Mat &m2, const Option &opt) {
     if (m1.empty() || m2.empty()) return {};
-    Mat res;
-    res.create_like(m1);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p1 = m1.channel(i);
-        const float *p2 = m2.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = p1[j] / p2[j];
-        }
-    }
-    return res;
+    return expr::eval(expr::ref(m1) / m2, opt);
 }
 
 Mat matproduct(const Mat &m1, const Mat &m2, const Option &opt) {
     if (m1.empty() || m2.empty()) return {};
-    Mat res;
-    res.create_like(m1);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p1 = m1.channel(i);
-        const float *p2 = m2.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = p1[j] * p2[j];
-        }
-    }
-    return res;
+    return expr::eval(expr::ref(m1) * m2, opt);
 }
 
 Mat product(const Mat &m, float value, const Option &opt) {
     if (m.empty()) return m;
-    Mat res;
-    res.create_like(m);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p = m.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = p[j] * value;
-        }
-    }
-    return res;
+    return expr::eval(expr::ref(m) * value, opt);
 }
 
 Mat matpow(const Mat &m, float value, const Option &opt) {
     if (m.empty()) return m;
-    Mat res;
-    res.create_like(m);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p = m.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = pow(p[j], value);
-        }
-    }
-    return res;
+    return expr::eval(expr::pow(m, value), opt);
 }
 
 Mat matexp(const Mat &m, const Option &opt) {
     if (m.empty()) return m;
-    Mat res;
-    res.create_like(m);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p = m.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = exp(p[j]);
-        }
-    }
-    return res;
+    return expr::eval(expr::exp(m), opt);
 }
 
 Mat ceil(const Mat &m, const Option &opt) {
     if (m.empty()) return m;
     Mat res;
-    res.create_like(m);
+    res.create_like(m, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < res.c; i++) {
         const float *p = m.channel(i);
@@ -476,7 +402,7 @@ Mat ceil(const Mat &m, const Option &opt) {
 Mat sum(const Mat &m, const Option &opt) {
     if (m.empty()) return m;
     Mat res;
-    res.create(1);
+    res.create(1, (size_t) 4u, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < res.c; i++) {
         const float *p = m.channel(i);
@@ -492,32 +418,12 @@ Mat sum(const Mat &m, const Option &opt) {
 
 Mat div(const Mat &m, float value, const Option &opt) {
     if (m.empty()) return m;
-    Mat res;
-    res.create_like(m);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p = m.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = p[j] / value;
-        }
-    }
-    return res;
+    return expr::eval(expr::ref(m) / value, opt);
 }
 
 Mat matsqrt(const Mat &m, const Option &opt) {
     if (m.empty()) return m;
-    Mat res;
-    res.create_like(m);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p = m.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = sqrt(p[j]);
-        }
-    }
-    return res;
+    return expr::eval(expr::sqrt(m), opt);
 }
 
 float matmax(const Mat &m, const Option &opt) {
@@ -537,8 +443,8 @@ float matmax(const Mat &m, const Option &opt) {
 Mat expand(const Mat &m, int w, int h, const Option &opt) {
     if (m.empty()) return m;
     Mat res;
-    if (m.dims > 2) res.create(w, h, m.c);
-    else res.create(w, h);
+    if (m.dims > 2) res.create(w, h, m.c, (size_t) 4u, opt.blob_allocator);
+    else res.create(w, h, (size_t) 4u, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < m.c; i++) {
         const float *p = m.channel(i);
@@ -563,17 +469,12 @@ Mat expand(const Mat &m, int w, int h, const Option &opt) {
 
 Mat randn(int w, int h, const Option &opt, int c) {
     Mat res;
-    if (c == 0) res.create(w, h);
-    else res.create(w, h, c);
-    std::mt19937 generator(std::time(nullptr));
-    std::normal_distribution<float> distribution(0.0, 1.0);
-#pragma omp parallel for num_threads(opt.num_threads)
+    if (c == 0) res.create(w, h, (size_t) 4u, opt.blob_allocator);
+    else res.create(w, h, c, (size_t) 4u, opt.blob_allocator);
+    if (res.empty()) return res;
+    // one draw per channel keeps the stream position independent of the channel padding
     for (int i = 0; i < res.c; i++) {
-        float *ptr = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            float rand_float = distribution(generator);
-            ptr[j] = rand_float;
-        }
+        stream_normal(res.channel(i), res.w * res.h, opt);
     }
     return res;
 }
@@ -586,13 +487,13 @@ Mat sequence_mask(const Mat &length, const Option &opt, float max_length_) {
     } else {
         max_length = int(max_length_);
     }
-    Mat x(max_length, 1);
+    Mat x(max_length, 1, (size_t) 4u, opt.blob_allocator);
     float *p = x.channel(0);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < max_length; i++) {
         p[i] = float(i);
     }
-    Mat res(x.w, length.w);
+    Mat res(x.w, length.w, (size_t) 4u, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < x.c; i++) {
         float *out = res.channel(i);
@@ -622,6 +523,36 @@ Mat generate_path(const Mat &duration, const Mat &mask, const Option &opt) {
     return path;
 }
 
+// same result as matmul(generate_path(duration, mask), x^T)^T for a monotonic path: frame t copies
+// the column i with cumsum(duration)[i - 1] <= t < cumsum(duration)[i], frames past the end stay 0
+Mat expand_by_duration(const Mat &x, const Mat &duration, int t_y, const Option &opt) {
+    if (x.empty() || duration.empty() || t_y <= 0) return {};
+    int t_x = std::min(x.w, duration.w);
+    const float *d = duration;
+    std::vector<int> ends(t_x);
+    float cum = 0;
+    for (int i = 0; i < t_x; i++) {
+        cum += d[i];
+        ends[i] = std::min(std::max((int) std::ceil(cum), 0), t_y);
+    }
+
+    Mat res(t_y, x.h, (size_t) 4u, opt.blob_allocator);
+#pragma omp parallel for num_threads(opt.num_threads)
+    for (int i = 0; i < x.h; i++) {
+        const float *ptr = x.row(i);
+        float *out = res.row(i);
+        int start = 0;
+        for (int j = 0; j < t_x; j++) {
+            if (ends[j] > start) {
+                std::fill(out + start, out + ends[j], ptr[j]);
+                start = ends[j];
+            }
+        }
+        std::fill(out + start, out + t_y, 0.f);
+    }
+    return res;
+}
+
 Mat mattranspose(const Mat &m, const Option &opt) {
     if (m.empty()) return m;
     int w = m.w;
@@ -631,7 +562,7 @@ Mat mattranspose(const Mat &m, const Option &opt) {
     int target_h = w;
     int target_w = h;
 
-    Mat res(target_w, target_h, c);
+    Mat res(target_w, target_h, c, (size_t) 4u, opt.blob_allocator);
 
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < c; i++) {
@@ -651,27 +582,12 @@ Mat mattranspose(const Mat &m, const Option &opt) {
 Mat matmul(const Mat &m1, const Mat &m2, const Option &opt) {
     if (m1.empty() || m2.empty()) return {};
     Mat res;
-    res.create(m2.w, m1.h, m1.c);
+    res.create(m2.w, m1.h, m1.c, (size_t) 4u, opt.blob_allocator);
 
-#pragma omp parallel for num_threads(opt.num_threads)
+    // each channel is one packed gemm, threads split the rows inside sgemm
     for (int i = 0; i < m1.c; i++) {
-        // get row1
-        const float *p1 = m1.channel(i);
-        const float *p2 = m2.channel(i);
-        float *p = res.channel(i);
-        for (int j = 0; j < m1.h; j++) {
-            // iterate m2 columns
-            for (int k = 0; k < m2.w; k++) {
-                // sum m1 row and m2 columns
-                float sum = 0;
-                for (int n = 0; n < m2.h; n++) {
-                    sum += p1[n] * p2[k + n * m2.w];
-                }
-                p[0] = sum;
-                p++;
-            }
-            p1 += m1.w;
-        }
+        sgemm(m1.h, m2.w, m2.h, m1.channel(i), m1.w, m2.channel(i), m2.w, res.channel(i), res.w,
+              opt);
     }
     return res;
 }
@@ -682,26 +598,27 @@ void mask_fill(Mat &m, const Mat &mask, const char *condition, float condition_v
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < m.c; i++) {
         float *ptr = m.channel(i);
-        const float *m_ptr = mask.channel(i);
+        // a single channel mask applies to every channel
+        const float *m_ptr = mask.channel(mask.c == 1 ? 0 : i);
         for (int j = 0; j < m.w * m.h; j++) {
-            if (!strcmp(condition, "=") && m_ptr[i] == condition_value) {
-                ptr[i] = value;
+            if (!strcmp(condition, "=") && m_ptr[j] == condition_value) {
+                ptr[j] = value;
                 continue;
             }
-            if (!strcmp(condition, ">") && m_ptr[i] > condition_value) {
-                ptr[i] = value;
+            if (!strcmp(condition, ">") && m_ptr[j] > condition_value) {
+                ptr[j] = value;
                 continue;
             }
-            if (!strcmp(condition, "<") && m_ptr[i] < condition_value) {
-                ptr[i] = value;
+            if (!strcmp(condition, "<") && m_ptr[j] < condition_value) {
+                ptr[j] = value;
                 continue;
             }
-            if (!strcmp(condition, ">=") && m_ptr[i] >= condition_value) {
-                ptr[i] = value;
+            if (!strcmp(condition, ">=") && m_ptr[j] >= condition_value) {
+                ptr[j] = value;
                 continue;
             }
-            if (!strcmp(condition, "<=") && m_ptr[i] <= condition_value) {
-                ptr[i] = value;
+            if (!strcmp(condition, "<=") && m_ptr[j] <= condition_value) {
+                ptr[j] = value;
                 continue;
             }
         }
@@ -718,7 +635,7 @@ Mat get_relative_embeddings(const Mat &relative_embeddings, int length, int wind
         padded_relative_embeddings = pad(relative_embeddings, pad_length,
                                          pad_length, 0, 0, 0, opt);
     } else {
-        padded_relative_embeddings = relative_embeddings.clone();
+        padded_relative_embeddings = relative_embeddings.clone(opt.blob_allocator);
     }
     // slicing
     Mat used_relative_embeddings = Slice(padded_relative_embeddings, slice_start_position,
@@ -731,7 +648,7 @@ Mat matmul_with_relative_keys(const Mat &x, const Mat &y, const Option &opt) {
     if (x.empty() || y.empty()) return {};
     // concat
     Mat y_;
-    y_.create(y.w, y.h, y.c * 2);
+    y_.create(y.w, y.h, y.c * 2, (size_t) 4u, opt.blob_allocator);
     const float *y_ptr = y.channel(0);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < y_.c; i++) {
@@ -777,7 +694,7 @@ Mat matmul_with_relative_values(const Mat &x, const Mat &y, const Option &opt) {
     if (x.empty() || y.empty()) return {};
     // concat
     Mat y_;
-    y_.create(y.w, y.h, y.c * 2);
+    y_.create(y.w, y.h, y.c * 2, (size_t) 4u, opt.blob_allocator);
     const auto *y_p = (const float *) y;
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < y_.c; i++) {
@@ -789,14 +706,14 @@ Mat matmul_with_relative_values(const Mat &x, const Mat &y, const Option &opt) {
 
 Mat zeros_like(const Mat &x, const Option &opt) {
     if (x.empty()) return x;
-    Mat out = x.clone();
+    Mat out = x.clone(opt.blob_allocator);
     out.fill(0);
     return out;
 }
 
 Mat concat(const Mat &m1, const Mat &m2, const Option &opt) {
     if (m1.empty() || m2.empty()) return {};
-    Mat res(m1.w, m1.h + m2.h);
+    Mat res(m1.w, m1.h + m2.h, (size_t) 4u, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < m1.c; i++) {
         const float *p1 = m1.channel(i);
@@ -817,91 +734,15 @@ Mat concat(const Mat &m1, const Mat &m2, const Option &opt) {
 }
 
 std::string join_path(const std::string &folder, const std::string &file) {
-    if (folder.find_last_of('/') || folder.find_last_of('\\')) {
+    if (folder.empty() || folder.back() == '/' || folder.back() == '\\') {
         return folder + file;
     } else {
         return folder + "/" + file;
     }
 }
 
-std::vector<std::complex<fftpack_real>>
-rfft1d(const fftpack_real *data, const fftpack_int size, const Option &opt) {
-    std::vector<std::complex<float>> res;
-
-    auto *rfin = new fftpack_real[size];
-
-    memcpy(rfin, data, size * sizeof(fftpack_real));
-
-    auto *wsave = new fftpack_real[size * 3];
-
-    rffti(size, wsave);
-    rfftf(size, rfin, wsave);
-
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < size; i++) {
-        if (i == 0 || i == size - 1) {
-            res.emplace_back(rfin[i], 0);
-            continue;
-        }
-        if (i % 2 == 1 && i < size) {
-            res.emplace_back(rfin[i], rfin[i + 1]);
-        }
-    }
-    delete[] rfin;
-    delete[] wsave;
-    return res;
-}
-
-std::vector<Mat> rfft(const Mat &m, const Option &opt) {
-    if (m.empty()) return {};
-    Mat real, image;
-    if (m.dims == 2) {
-        real.create(m.w / 2 + 1, m.h);
-        image.create(m.w / 2 + 1, m.h);
-    }
-    if (m.dims == 3) {
-        real.create(m.w / 2 + 1, m.h, m.c);
-        image.create(m.w / 2 + 1, m.h, m.c);
-    }
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < m.c; i++) {
-        const float *ptr = m.channel(i);
-        float *real_ptr = real.channel(i);
-        float *imag_ptr = image.channel(i);
-        for (int j = 0; j < m.h; j++) {
-            auto *input = new float[m.w];
-
-            memcpy(input, ptr, m.w * sizeof(float));
-            auto rfft_out = rfft1d(input, m.w, opt);
-
-            // get real
-            std::vector<float> real_v;
-            std::transform(rfft_out.begin(), rfft_out.end(), std::back_inserter(real_v),
-                           [](const std::complex<float> &c) { return c.real(); });
-
-            // assign real
-            memcpy(real_ptr, real_v.data(), real_v.size() * sizeof(float));
-
-            // get image
-            std::vector<float> image_v;
-            std::transform(rfft_out.begin(), rfft_out.end(), std::back_inserter(image_v),
-                           [](const std::complex<float> &c) { return c.imag(); });
-
-            // assign image
-            memcpy(imag_ptr, image_v.data(), image_v.size() * sizeof(float));
-
-            delete[] input;
-
-            ptr += m.w;
-            real_ptr += real.w;
-            imag_ptr += image.w;
-        }
-    }
-    return std::vector<Mat>{real, image};
-}
-
 Mat hanning_window(const int n, const Option &opt) {
-    Mat res(n, 1);
+    Mat res(n, 1, (size_t) 4u, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < res.c; i++) {
         float *ptr = res.channel(i);
@@ -914,7 +755,7 @@ Mat hanning_window(const int n, const Option &opt) {
 
 Mat as_strides(const Mat &x, const int h, const int w, const Option &opt) {
     if (x.empty()) return {};
-    Mat res(h, w);
+    Mat res(h, w, (size_t) 4u, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < x.c; i++) {
         const float *x_ptr = x.channel(i);
@@ -938,68 +779,14 @@ Mat frame(const Mat &x, const int frame_length, const int hop_length, const Opti
     return reducedims(xw);
 }
 
-std::vector<Mat>
-stft(const Mat &y, const int filter_length, const int hop_length, const int win_length,
-     const Option &opt) {
-    if (y.empty()) return {};
-    // hann window
-    auto fft_window = hanning_window(win_length, opt);
-    fft_window = reducedims(mattranspose(fft_window, opt));
-    int pad_window_size = (filter_length - win_length) / 2;
-
-    // pad window
-    fft_window = pad(fft_window, 0, 0,
-                     pad_window_size, pad_window_size, 0, opt);
-
-    // pad y
-    int pad_y_size = filter_length / 2;
-    Mat y_padded = pad(y, 0, 0, pad_y_size, pad_y_size, 0, opt);
-
-    // get frames
-    auto y_frames = frame(y_padded, filter_length, hop_length, opt);
-
-    int n_columns = MAX_MEM_BLOCK / (2 * sizeof(float) * (y_frames.h / 2 + 1));
-    n_columns = std::max(n_columns, 1);
-
-    Mat real, imag;
-
-    // stft
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int bl_s = 0; bl_s < y_frames.w; bl_s += n_columns) {
-        int bl_t = std::min(bl_s + n_columns, y_frames.w);
-        auto y_frame_sliced = Slice(y_frames, 0, y_frames.h,
-                                    bl_s, bl_t, 1, 1, opt);
-        auto expaned_fft_window = expand(fft_window, y_frame_sliced.w, y_frame_sliced.h, opt);
-        auto fft_input = matproduct(expaned_fft_window, y_frame_sliced, opt);
-        auto fft_output = rfft(reducedims(mattranspose(fft_input, opt)), opt);
-        if (real.empty()) real = fft_output[0];
-        else real = concat(real, fft_output[0], opt);
-        if (imag.empty()) imag = fft_output[1];
-        else imag = concat(imag, fft_output[1], opt);
-    }
-    real = reducedims(mattranspose(real, opt));
-    imag = reducedims(mattranspose(imag, opt));
-    return std::vector<Mat>{real, imag};
-}
-
 Mat Plus(const Mat &m, float value, const Option &opt) {
     if (m.empty()) return m;
-    Mat res;
-    res.create_like(m);
-#pragma omp parallel for num_threads(opt.num_threads)
-    for (int i = 0; i < res.c; i++) {
-        const float *p = m.channel(i);
-        float *out = res.channel(i);
-        for (int j = 0; j < res.w * res.h; j++) {
-            out[j] = p[j] + value;
-        }
-    }
-    return res;
+    return expr::eval(expr::ref(m) + value, opt);
 }
 
 Mat embedding(const Mat &x, const Mat &weight, const Option &opt) {
     if (x.empty() || weight.empty()) return {};
-    Mat output(weight.w, x.w * x.h);
+    Mat output(weight.w, x.w * x.h, (size_t) 4u, opt.blob_allocator);
     if (output.empty()) return {};
 
 #pragma omp parallel for num_threads(opt.num_threads)
@@ -1018,7 +805,7 @@ Mat embedding(const Mat &x, const Mat &weight, const Option &opt) {
 
 Mat flip(const Mat &x, const Option &opt, int dim) {
     Mat output;
-    output.create_like(x);
+    output.create_like(x, opt.blob_allocator);
 #pragma omp parallel for num_threads(opt.num_threads)
     for (int i = 0; i < x.c; i++) {
         const float *p = x.channel(i);
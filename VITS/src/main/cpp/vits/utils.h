@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <vector>
+#include <algorithm>
 #include <math.h>
 #include <numeric>
 #include <iostream>
@@ -10,7 +11,11 @@
 #include <iomanip>
 #include <random>
 #include <cstdio>
+#include <cstring>
+#include <cfloat>
+#ifdef __ANDROID__
 #include <android/log.h>
+#endif
 
 // ncnn
 #include "layer.h"
@@ -20,17 +25,30 @@
 
 // fft
 #include "../fftpack/fftpack.h"
+#include "gemm.h"
+#include "random.h"
+#include "stft.h"
 #include <complex>
 
 #define PI 3.14159265358979323846
 #define MAX_MEM_BLOCK 262144
 
 #define TAG "Moereng" // ԶLOGıʶ
+#ifdef __ANDROID__
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG,TAG ,__VA_ARGS__) // LOGD
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO,TAG ,__VA_ARGS__) // LOGI
 #define LOGW(...) __android_log_print(ANDROID_LOG_WARN,TAG ,__VA_ARGS__) // LOGW
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR,TAG ,__VA_ARGS__) // LOGE
 #define LOGF(...) __android_log_print(ANDROID_LOG_FATAL,TAG ,__VA_ARGS__) // LOGF
+#else
+// host builds log to stderr
+#define HOST_LOG(level, ...) do { fprintf(stderr, "%s/" TAG ": ", level); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define LOGD(...) HOST_LOG("D", __VA_ARGS__)
+#define LOGI(...) HOST_LOG("I", __VA_ARGS__)
+#define LOGW(...) HOST_LOG("W", __VA_ARGS__)
+#define LOGE(...) HOST_LOG("E", __VA_ARGS__)
+#define LOGF(...) HOST_LOG("F", __VA_ARGS__)
+#endif
 
 using namespace ncnn;
 
@@ -50,6 +68,8 @@ Mat expanddims(const Mat& m);
 
 Mat expand(const Mat& m, int w, int h, const Option& opt);
 
+Mat expand_by_duration(const Mat& x, const Mat& duration, int t_y, const Option& opt); // repeat column i of x duration[i] times
+
 Mat embedding(const Mat& x, const Mat& weight, const Option& opt);
 
 Mat frame(const Mat& x, const int frame_length, const int hop_length, const Option& opt);
@@ -96,11 +116,7 @@ Mat Plus(const Mat& m, float value, const Option& opt);
 
 Mat reducedims(const Mat& m);
 
-Mat randn(int w, int h, const Option& opt, int c = 0);
-
-std::vector<std::complex<fftpack_real>> rfft1d(const fftpack_real* data, const fftpack_int size, const Option& opt);
-
-std::vector<Mat> rfft(const Mat& m, const Option& opt); // rfft for dim 0
+Mat randn(int w, int h, const Option& opt, int c = 0); // standard normal noise from the thread's NoiseScope stream
 
 Mat softmax(const Mat &m, const Option &opt); // softmax
 
@@ -117,9 +133,6 @@ Mat sum(const Mat& m, const Option& opt);
 
 Mat sequence_mask(const Mat& length,  const Option& opt, float max_length_ = 0);
 
-std::vector<Mat> stft(const Mat& y, const int filter_length, const int hop_length,
-                      const int win_length, const Option& opt); // short time Fourier transform
-
 Mat zeros_like(const Mat& x, const Option& opt);
 
 Mat get_relative_embeddings(const Mat& relative_embeddings, int length, int window_size, const Option& opt);
@@ -0,0 +1,157 @@
+#include "weight_format.h"
+#include "datareader.h"
+#include "modelbin.h"
+#include "utils.h"
+
+// tags ncnn's ModelBin reads ahead of every auto typed (type 0) tensor
+#define WEIGHT_TAG_FP32 0x00000000u
+#define WEIGHT_TAG_FP16 0x01306B47u
+// any other non zero tag means a 256 float table followed by one index byte per weight
+#define WEIGHT_TAG_TABLE 0x00000001u
+
+#define TABLE_SIZE 256
+#define TABLE_ITERATIONS 16
+
+const char *weight_format_name(WeightFormat format) {
+    switch (format) {
+        case WEIGHTS_FP16:
+            return "fp16";
+        case WEIGHTS_INT8:
+            return "int8";
+        default:
+            return "fp32";
+    }
+}
+
+std::string weight_file(const std::string &folder, const std::string &name, WeightFormat format) {
+    if (format == WEIGHTS_FP32) return join_path(folder, name + ".ncnn.bin");
+    return join_path(folder, name + "." + weight_format_name(format) + ".ncnn.bin");
+}
+
+// 256 levels fitted to the values by 1-d k-means: starting from quantiles, every level moves to
+// the mean of the values closest to it. On sorted values each cluster is a range, so one
+// iteration is a binary search and a prefix sum lookup per level. The extremes stay levels of
+// their own, rare large weights matter more than their share of the squared error
+static void fit_table(const float *data, int w, float *table, unsigned char *indexes) {
+    std::vector<float> sorted(data, data + w);
+    std::sort(sorted.begin(), sorted.end());
+    std::vector<double> prefix(w + 1, 0.0);
+    for (int i = 0; i < w; i++) prefix[i + 1] = prefix[i] + sorted[i];
+
+    for (int k = 0; k < TABLE_SIZE; k++) {
+        table[k] = sorted[std::min(w - 1, int((k + 0.5) * w / TABLE_SIZE))];
+    }
+    float bounds[TABLE_SIZE - 1];
+    for (int it = 0; it < TABLE_ITERATIONS; it++) {
+        for (int k = 0; k < TABLE_SIZE - 1; k++) bounds[k] = (table[k] + table[k + 1]) * 0.5f;
+        int begin = 0;
+        for (int k = 0; k < TABLE_SIZE; k++) {
+            int end = k == TABLE_SIZE - 1 ? w : int(
+                    std::lower_bound(sorted.begin() + begin, sorted.end(), bounds[k]) -
+                    sorted.begin());
+            if (end > begin) table[k] = float((prefix[end] - prefix[begin]) / (end - begin));
+            begin = end;
+        }
+        // levels stay sorted, empty ones keep their place
+        std::sort(table, table + TABLE_SIZE);
+        table[0] = sorted[0];
+        table[TABLE_SIZE - 1] = sorted[w - 1];
+    }
+
+    for (int k = 0; k < TABLE_SIZE - 1; k++) bounds[k] = (table[k] + table[k + 1]) * 0.5f;
+    for (int i = 0; i < w; i++) {
+        indexes[i] = (unsigned char) (std::lower_bound(bounds, bounds + TABLE_SIZE - 1, data[i]) -
+                                      bounds);
+    }
+}
+
+// passes every tensor a layer asks for through to the layer and writes it to out in format
+class ConvertingModelBin : public ModelBin {
+private:
+    DataReaderFromStdio reader;
+    ModelBinFromDataReader source;
+    FILE *out;
+    WeightFormat format;
+
+public:
+    mutable bool ok = true;
+
+    ConvertingModelBin(FILE *in, FILE *out, WeightFormat format) : reader(in), source(reader),
+                                                                     out(out), format(format) {}
+
+    Mat load(int w, int type) const override {
+        Mat m = source.load(w, type);
+        // int8 tensors of quantized nets are already as small as they get
+        if (m.empty() || m.elemsize != sizeof(float)) {
+            ok = false;
+            return m;
+        }
+        if (type != 0) {
+            write(m, w * sizeof(float));
+            return m;
+        }
+
+        WeightFormat tensor_format = format;
+        if (tensor_format == WEIGHTS_INT8 && w <= TABLE_SIZE * 4) tensor_format = WEIGHTS_FP16;
+        if (tensor_format == WEIGHTS_FP16) {
+            std::vector<unsigned short> half(alignSize(w * sizeof(unsigned short), 4) / 2, 0);
+            const float *p = m;
+            for (int i = 0; i < w; i++) half[i] = float32_to_float16(p[i]);
+            write_tag(WEIGHT_TAG_FP16);
+            write(half.data(), half.size() * sizeof(unsigned short));
+        } else if (tensor_format == WEIGHTS_INT8) {
+            float table[TABLE_SIZE];
+            std::vector<unsigned char> indexes(alignSize(w, 4), 0);
+            fit_table(m, w, table, indexes.data());
+            write_tag(WEIGHT_TAG_TABLE);
+            write(table, sizeof(table));
+            write(indexes.data(), indexes.size());
+        } else {
+            write_tag(WEIGHT_TAG_FP32);
+            write(m, w * sizeof(float));
+        }
+        return m;
+    }
+
+private:
+    void write(const void *data, size_t size) const {
+        if (fwrite(data, 1, size, out) != size) ok = false;
+    }
+
+    void write_tag(unsigned int tag) const {
+        write(&tag, sizeof(tag));
+    }
+};
+
+bool convert_weights(const Net &net, const std::string &src_path, const std::string &dst_path,
+                     WeightFormat format) {
+    FILE *in = fopen(src_path.c_str(), "rb");
+    if (in == nullptr) {
+        LOGE("cannot read %s", src_path.c_str());
+        return false;
+    }
+    FILE *out = fopen(dst_path.c_str(), "wb");
+    if (out == nullptr) {
+        LOGE("cannot write %s", dst_path.c_str());
+        fclose(in);
+        return false;
+    }
+    bool ok;
+    {
+        ConvertingModelBin mb(in, out, format);
+        // the same walk as Net::load_model, so every tensor is met in file order
+        for (Layer *layer: net.layers()) {
+            if (layer->load_model(mb) != 0) mb.ok = false;
+            if (!mb.ok) break;
+        }
+        // nothing of src may be left over
+        ok = mb.ok && fgetc(in) == EOF;
+    }
+    fclose(in);
+    if (fclose(out) != 0) ok = false;
+    if (!ok) {
+        LOGE("%s does not match the param", src_path.c_str());
+        remove(dst_path.c_str());
+    }
+    return ok;
+}
@@ -0,0 +1,31 @@
+#ifndef WEIGHT_FORMAT_H
+#define WEIGHT_FORMAT_H
+
+#include <string>
+#include "net.h"
+
+using namespace ncnn;
+
+// how the weights of a net are stored in its .ncnn.bin, ncnn expands every format to fp32 Mats
+// at load time, so the formats differ in file size and load time but not in the layers run
+enum WeightFormat {
+    WEIGHTS_FP32 = 0,
+    // half precision, half the size
+    WEIGHTS_FP16 = 1,
+    // one byte per weight indexing a 256 entry table fitted to the tensor, a quarter of the size
+    WEIGHTS_INT8 = 2,
+};
+
+// "fp32", "fp16" or "int8"
+const char *weight_format_name(WeightFormat format);
+
+// <folder>/<name>.ncnn.bin for fp32, <folder>/<name>.<format name>.ncnn.bin otherwise
+std::string weight_file(const std::string &folder, const std::string &name, WeightFormat format);
+
+// rewrites the weights src_path holds for net, whose param is already loaded, to dst_path in
+// format. Tensors ncnn always reads as raw fp32 (biases, MemoryData) keep it, int8 tensors too
+// small to pay for their table are stored as fp16. False if src_path does not fit the param
+bool convert_weights(const Net &net, const std::string &src_path, const std::string &dst_path,
+                     WeightFormat format);
+
+#endif
@@ -1,13 +1,84 @@
 #include <jni.h>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "openjtalk/api/api.h"
-#include "vits/SynthesizerTrn.h"
+#include "vits/SynthesisEngine.h"
 #include "wave_utils/wave.h"
 
-static ncnn::UnlockedPoolAllocator g_blob_pool_allocator;
-static ncnn::PoolAllocator g_workspace_pool_allocator;
-static SynthesizerTrn* net_g = nullptr;
 static OpenJtalk openJtalk;
-static Option opt;
+
+// loaded engines by handle, a request holds a reference so destroy_engine never pulls a model
+// out from under a running synthesis. Handle 0 is never issued
+static std::mutex g_engines_lock;
+static std::map<jlong, std::shared_ptr<SynthesisEngine>> g_engines;
+static jlong g_next_handle = 1;
+// engine behind the single-model functions (init_vits / forward / ...)
+static jlong g_default_engine = 0;
+
+static jlong register_engine(const std::shared_ptr<SynthesisEngine> &engine) {
+    std::lock_guard<std::mutex> guard(g_engines_lock);
+    jlong handle = g_next_handle++;
+    g_engines[handle] = engine;
+    return handle;
+}
+
+static std::shared_ptr<SynthesisEngine> find_engine(jlong handle) {
+    std::lock_guard<std::mutex> guard(g_engines_lock);
+    auto it = g_engines.find(handle);
+    if (it == g_engines.end()) return nullptr;
+    return it->second;
+}
+
+static void unregister_engine(jlong handle) {
+    std::shared_ptr<SynthesisEngine> engine;
+    {
+        std::lock_guard<std::mutex> guard(g_engines_lock);
+        auto it = g_engines.find(handle);
+        if (it == g_engines.end()) return;
+        engine = it->second;
+        g_engines.erase(it);
+    }
+    // the model is freed outside the lock, or later by the last request still using it
+    engine.reset();
+}
+
+static std::shared_ptr<SynthesisEngine> default_engine() {
+    std::lock_guard<std::mutex> guard(g_engines_lock);
+    auto it = g_engines.find(g_default_engine);
+    if (it == g_engines.end()) return nullptr;
+    return it->second;
+}
+
+static std::shared_ptr<SynthesisEngine>
+load_engine(JNIEnv *env, jobject asset_manager, jstring path, jboolean voice_convert,
+            jboolean multi, jint n_vocab, jint weight_format = WEIGHTS_FP32) {
+    const char *_path = env->GetStringUTFChars(path, nullptr);
+    std::string model_folder(_path);
+    env->ReleaseStringUTFChars(path, _path);
+
+    auto assetManager = AAssetManager_fromJava(env, asset_manager);
+
+    std::shared_ptr<SynthesisEngine> engine(new SynthesisEngine());
+    if (!engine->init(model_folder, voice_convert, multi, n_vocab, assetManager,
+                      WeightFormat(weight_format)))
+        return nullptr;
+    return engine;
+}
+
+// tokens of a java int array as the (n x 1) float Mat the synthesizer takes
+static Mat tokens_to_mat(JNIEnv *env, jintArray x) {
+    jsize x_size = env->GetArrayLength(x);
+    Mat data(x_size, 1);
+    if (data.empty()) return data;
+    int *x_ = env->GetIntArrayElements(x, nullptr);
+    float *p = data;
+    for (int j = 0; j < x_size; j++) {
+        p[j] = (float) x_[j];
+    }
+    env->ReleaseIntArrayElements(x, x_, JNI_ABORT);
+    return data;
+}
 
 JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
     LOGD("JNI_OnLoad");
@@ -17,11 +88,12 @@ JNIEXPORT jint JNI_OnLoad(JavaVM *vm, void *reserved) {
 
 JNIEXPORT void JNI_OnUnload(JavaVM *vm, void *reserved) {
     LOGD("JNI_OnUnload");
-    ncnn::destroy_gpu_instance();
-    if (net_g != nullptr){
-        delete net_g;
-        net_g = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(g_engines_lock);
+        g_engines.clear();
+        g_default_engine = 0;
     }
+    ncnn::destroy_gpu_instance();
 }
 
 // vits utils
@@ -45,12 +117,70 @@ Java_com_chatwaifu_vits_utils_VitsUtils_testGpu(JNIEnv *env, jobject thiz) {
 JNIEXPORT jstring JNICALL
 Java_com_chatwaifu_vits_utils_text_JapaneseTextUtils_splitSentenceCpp(JNIEnv *env, jobject thiz,
                                                                        jstring text) {
-    char *ctext = (char *) env->GetStringUTFChars(text, nullptr);
-    string stext(ctext);
-    string res = openJtalk.words_split(stext.c_str());
+    const char *ctext = env->GetStringUTFChars(text, nullptr);
+    string res = openJtalk.words_split(ctext);
+    env->ReleaseStringUTFChars(text, ctext);
     return env->NewStringUTF(res.c_str());
 }
 
+JNIEXPORT jlong JNICALL
+Java_com_chatwaifu_vits_utils_text_JapaneseTextUtils_createSegmenter(JNIEnv *env, jobject thiz,
+                                                                      jint max_chars) {
+    return (jlong) new SentenceSegmenter(max_chars);
+}
+
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_utils_text_JapaneseTextUtils_destroySegmenter(JNIEnv *env, jobject thiz,
+                                                                       jlong handle) {
+    delete (SentenceSegmenter *) handle;
+}
+
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_utils_text_JapaneseTextUtils_segmenterPush(JNIEnv *env, jobject thiz,
+                                                                    jlong handle, jstring text) {
+    const char *ctext = env->GetStringUTFChars(text, nullptr);
+    ((SentenceSegmenter *) handle)->push(ctext);
+    env->ReleaseStringUTFChars(text, ctext);
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_chatwaifu_vits_utils_text_JapaneseTextUtils_segmenterNext(JNIEnv *env, jobject thiz,
+                                                                    jlong handle, jboolean flush) {
+    string sentence;
+    if (!((SentenceSegmenter *) handle)->next(sentence, flush)) return nullptr;
+    return env->NewStringUTF(sentence.c_str());
+}
+
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_utils_text_JapaneseTextUtils_configureLabelCache(JNIEnv *env, jobject thiz,
+                                                                          jlong budget_bytes,
+                                                                          jstring file) {
+    openJtalk.labels().configure(size_t(max(budget_bytes, jlong(0))));
+    if (file == nullptr) return;
+    const char *_file = env->GetStringUTFChars(file, nullptr);
+    // no file yet on the first run
+    if (openJtalk.labels().load(_file)) LOGI("label cache loaded from %s", _file);
+    env->ReleaseStringUTFChars(file, _file);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_chatwaifu_vits_utils_text_JapaneseTextUtils_saveLabelCache(JNIEnv *env, jobject thiz,
+                                                                     jstring file) {
+    const char *_file = env->GetStringUTFChars(file, nullptr);
+    bool ok = openJtalk.labels().save(_file);
+    env->ReleaseStringUTFChars(file, _file);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jlongArray JNICALL
+Java_com_chatwaifu_vits_utils_text_JapaneseTextUtils_labelCacheStats(JNIEnv *env, jobject thiz) {
+    jlong stats[2] = {jlong(openJtalk.labels().hit_count()),
+                      jlong(openJtalk.labels().miss_count())};
+    jlongArray result = env->NewLongArray(2);
+    env->SetLongArrayRegion(result, 0, 2, stats);
+    return result;
+}
+
 JNIEXPORT jint JNICALL
 Java_com_chatwaifu_vits_utils_VitsUtils_checkThreadsCpp(JNIEnv *env, jobject thiz) {
     return ncnn::get_physical_big_cpu_count();
@@ -59,21 +189,25 @@ Java_com_chatwaifu_vits_utils_VitsUtils_checkThreadsCpp(JNIEnv *env, jobject thi
 JNIEXPORT jobject JNICALL
 Java_com_chatwaifu_vits_utils_text_JapaneseCleaners_extract_1labels(JNIEnv *env, jobject thiz,
                                                                      jstring text) {
-    char *ctext = (char *) env->GetStringUTFChars(text, nullptr);
-    // 转换编码
-    string stext(ctext);
-    wstring wtext = utf8_decode(stext);
+    const char *ctext = env->GetStringUTFChars(text, nullptr);
     jclass array_list_class = env->FindClass("java/util/ArrayList");
     jmethodID array_list_constructor = env->GetMethodID(array_list_class, "<init>", "()V");
     jobject array_list = env->NewObject(array_list_class, array_list_constructor);
     jmethodID array_list_add = env->GetMethodID(array_list_class, "add", "(Ljava/lang/Object;)Z");
 
-    auto features = openJtalk.run_frontend(wtext);
-    auto labels = openJtalk.make_label(features);
+    // a context of this call's own, so several threads can convert text at once. The labels
+    // are valid while the lease is held
+    OpenJtalk::Lease context = openJtalk.acquire();
+    if (!context) {
+        env->ReleaseStringUTFChars(text, ctext);
+        return array_list;
+    }
+    const auto &labels = context->extract_labels(ctext);
+    env->ReleaseStringUTFChars(text, ctext);
 
     // vector到列表
-    for (const wstring &label: labels) {
-        jstring str = env->NewStringUTF(utf8_encode(label).c_str());
+    for (const char *label: labels) {
+        jstring str = env->NewStringUTF(label);
         env->CallBooleanMethod(array_list, array_list_add, str);
         env->DeleteLocalRef(str);
     }
@@ -85,64 +219,75 @@ JNIEXPORT jboolean JNICALL
 Java_com_chatwaifu_vits_Vits_init_1vits(JNIEnv *env, jobject thiz, jobject asset_manager,
                                          jstring path, jboolean voice_convert, jboolean multi,
                                          jint n_vocab) {
-    if (net_g != nullptr) {
-        delete net_g;
-        net_g = nullptr;
+    // the previous model goes first so two of them are never resident through this path
+    jlong previous;
+    {
+        std::lock_guard<std::mutex> guard(g_engines_lock);
+        previous = g_default_engine;
+        g_default_engine = 0;
     }
+    unregister_engine(previous);
 
-    net_g = new SynthesizerTrn();
-
-    const char *_path = env->GetStringUTFChars(path, nullptr);
-
-    opt.lightmode = true;
-    opt.use_packing_layout = true;
-    opt.num_threads = get_big_cpu_count();
-    opt.blob_allocator = &g_blob_pool_allocator;
-    opt.workspace_allocator = &g_workspace_pool_allocator;
+    auto engine = load_engine(env, asset_manager, path, voice_convert, multi, n_vocab);
+    if (engine == nullptr) return JNI_FALSE;
+    jlong handle = register_engine(engine);
+    std::lock_guard<std::mutex> guard(g_engines_lock);
+    g_default_engine = handle;
+    return JNI_TRUE;
+}
 
-    // use vulkan compute
-    if (ncnn::get_gpu_count() != 0)
-        opt.use_vulkan_compute = true;
+// engines for several models at once, each handle from create_engine synthesizes independently
+// of the others and must be passed to destroy_engine when no longer needed
+JNIEXPORT jlong JNICALL
+Java_com_chatwaifu_vits_Vits_create_1engine(JNIEnv *env, jobject thiz, jobject asset_manager,
+                                             jstring path, jboolean voice_convert,
+                                             jboolean multi, jint n_vocab, jint weight_format) {
+    auto engine = load_engine(env, asset_manager, path, voice_convert, multi, n_vocab,
+                              weight_format);
+    if (engine == nullptr) return 0;
+    return register_engine(engine);
+}
 
-    auto assetManager = AAssetManager_fromJava(env, asset_manager);
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_Vits_destroy_1engine(JNIEnv *env, jobject thiz, jlong handle) {
+    unregister_engine(handle);
+}
 
-    bool ret = net_g->init(_path, voice_convert, multi, n_vocab, assetManager, opt);
-    if (ret) return JNI_TRUE;
-    else return JNI_FALSE;
+// a net the request needed failed to load: raised as IllegalStateException instead of handing
+// back no audio, so the app can tell a broken model from a cancelled request. An exception
+// thrown by the listener stays the pending one
+static void throw_load_error(JNIEnv *env, SynthesisEngine *engine) {
+    if (env->ExceptionCheck()) return;
+    std::string error = engine->load_error();
+    if (error.empty()) return;
+    LOGE("%s", error.c_str());
+    jclass exception = env->FindClass("java/lang/IllegalStateException");
+    env->ThrowNew(exception, error.c_str());
+    env->DeleteLocalRef(exception);
 }
 
-JNIEXPORT jfloatArray JNICALL
-Java_com_chatwaifu_vits_Vits_forward(JNIEnv *env, jobject thiz, jintArray x, jboolean vulkan,
-                                      jboolean multi, jint sid,
-                                      jfloat noise_scale,
-                                      jfloat noise_scale_w,
-                                      jfloat length_scale,
-                                      jint num_threads) {
-    if (net_g == nullptr) return {};
+static jfloatArray engine_forward(JNIEnv *env, SynthesisEngine *engine, jintArray x,
+                                  jboolean vulkan, jint sid, jfloat noise_scale,
+                                  jfloat noise_scale_w, jfloat length_scale, jint num_threads,
+                                  jlong seed) {
+    if (engine == nullptr) return {};
 
     // jarray to ncnn mat
-    int *x_ = env->GetIntArrayElements(x, nullptr);
-    jsize x_size = env->GetArrayLength(x);
-
-    Mat data(x_size, 1);
-    for (int i = 0; i < data.c; i++) {
-        float *p = data.channel(i);
-        for (int j = 0; j < x_size; j++) {
-            p[j] = (float) x_[j];
-        }
-    }
+    Mat data = tokens_to_mat(env, x);
 
     // inference
     if (vulkan) LOGI("vulkan on");
     else
         LOGI("vulkan off");
 
-    opt.num_threads = num_threads;
-    LOGD("threads = %d", opt.num_threads);
+    LOGD("threads = %d", num_threads);
     auto start = get_current_time();
-    auto output = net_g->forward(data, opt, vulkan, multi, sid,
-                                          noise_scale, noise_scale_w, length_scale);
-    if (output.empty()) return {};
+    auto output = engine->forward(data, num_threads, vulkan, sid, noise_scale, noise_scale_w,
+                                  length_scale, seed);
+    if (output.empty()) {
+        throw_load_error(env, engine);
+        return {};
+    }
     auto end = get_current_time();
     LOGI("time cost: %f ms", end - start);
     jfloatArray res = env->NewFloatArray(output.h * output.w);
@@ -150,33 +295,184 @@ Java_com_chatwaifu_vits_Vits_forward(JNIEnv *env, jobject thiz, jintArray x, jbo
     return res;
 }
 
-JNIEXPORT jfloatArray JNICALL
-Java_com_chatwaifu_vits_Vits_voice_1convert(JNIEnv *env, jobject thiz, jfloatArray audio,
-                                             jint raw_sid, jint target_sid, jboolean vulkan,
-                                             jint num_threads) {
-    if (net_g == nullptr) return {};
+static jboolean engine_forward_stream(JNIEnv *env, SynthesisEngine *engine, jintArray x,
+                                      jboolean vulkan, jint sid, jfloat noise_scale,
+                                      jfloat noise_scale_w, jfloat length_scale,
+                                      jint num_threads, jint chunk_frames, jlong seed,
+                                      jobject listener) {
+    if (engine == nullptr) return JNI_FALSE;
+
+    // jarray to ncnn mat
+    Mat data = tokens_to_mat(env, x);
+
+    jclass listener_class = env->GetObjectClass(listener);
+    jmethodID on_chunk = env->GetMethodID(listener_class, "onChunk", "([F)Z");
+    if (on_chunk == nullptr) return JNI_FALSE;
+
+    LOGD("threads = %d", num_threads);
+    auto start = get_current_time();
+    bool first_chunk = true;
+    auto callback = [&](const Mat &audio) -> bool {
+        if (first_chunk) {
+            LOGI("first audio after: %f ms", get_current_time() - start);
+            first_chunk = false;
+        }
+        int size = audio.w * audio.h;
+        jfloatArray chunk = env->NewFloatArray(size);
+        env->SetFloatArrayRegion(chunk, 0, size, audio);
+        jboolean keep_going = env->CallBooleanMethod(listener, on_chunk, chunk);
+        env->DeleteLocalRef(chunk);
+        if (env->ExceptionCheck()) return false;
+        return keep_going == JNI_TRUE;
+    };
+    bool ret = engine->forward_stream(data, callback, num_threads, vulkan, sid, noise_scale,
+                                      noise_scale_w, length_scale, seed, chunk_frames);
+    auto end = get_current_time();
+    LOGI("time cost: %f ms", end - start);
+    env->DeleteLocalRef(listener_class);
+    if (ret) return JNI_TRUE;
+    throw_load_error(env, engine);
+    return JNI_FALSE;
+}
+
+// every sentence to ncnn mat up front, the front stage runs on a thread without a JNIEnv
+static std::vector<Mat> sentences_to_mats(JNIEnv *env, jobjectArray sentences) {
+    jsize count = env->GetArrayLength(sentences);
+    std::vector<Mat> inputs;
+    inputs.reserve(count);
+    for (jsize i = 0; i < count; i++) {
+        auto x = (jintArray) env->GetObjectArrayElement(sentences, i);
+        inputs.push_back(tokens_to_mat(env, x));
+        env->DeleteLocalRef(x);
+    }
+    return inputs;
+}
+
+static jboolean engine_forward_sentences(JNIEnv *env, SynthesisEngine *engine,
+                                         jobjectArray sentences, jboolean vulkan, jint sid,
+                                         jfloat noise_scale, jfloat noise_scale_w,
+                                         jfloat length_scale, jint num_threads,
+                                         jint chunk_frames, jlong seed, jobject listener) {
+    if (engine == nullptr) return JNI_FALSE;
+
+    std::vector<Mat> inputs = sentences_to_mats(env, sentences);
+
+    jclass listener_class = env->GetObjectClass(listener);
+    jmethodID on_chunk = env->GetMethodID(listener_class, "onChunk", "([F)Z");
+    if (on_chunk == nullptr) return JNI_FALSE;
+
+    LOGD("threads = %d", num_threads);
+    auto start = get_current_time();
+    bool first_chunk = true;
+    // runs on this thread only, the decoder stage stays on the caller
+    auto callback = [&](const Mat &audio) -> bool {
+        if (first_chunk) {
+            LOGI("first audio after: %f ms", get_current_time() - start);
+            first_chunk = false;
+        }
+        int size = audio.w * audio.h;
+        jfloatArray chunk = env->NewFloatArray(size);
+        env->SetFloatArrayRegion(chunk, 0, size, audio);
+        jboolean keep_going = env->CallBooleanMethod(listener, on_chunk, chunk);
+        env->DeleteLocalRef(chunk);
+        if (env->ExceptionCheck()) return false;
+        return keep_going == JNI_TRUE;
+    };
+    bool ret = engine->forward_sentences(inputs, callback, num_threads, vulkan, sid, noise_scale,
+                                         noise_scale_w, length_scale, seed, chunk_frames);
+    auto end = get_current_time();
+    LOGI("time cost: %f ms", end - start);
+    env->DeleteLocalRef(listener_class);
+    if (ret) return JNI_TRUE;
+    throw_load_error(env, engine);
+    return JNI_FALSE;
+}
+
+// like engine_forward_sentences, but no java array is allocated per block: the samples are
+// written into the direct buffer given, native order floats from its start, and
+// listener.onChunk(buffer, samples) returns the direct buffer for the next block (null stops).
+// A block larger than the buffer is delivered in several pieces
+static jboolean engine_forward_sentences_into(JNIEnv *env, SynthesisEngine *engine,
+                                              jobjectArray sentences, jboolean vulkan, jint sid,
+                                              jfloat noise_scale, jfloat noise_scale_w,
+                                              jfloat length_scale, jint num_threads,
+                                              jint chunk_frames, jlong seed, jobject buffer,
+                                              jobject listener) {
+    if (engine == nullptr || buffer == nullptr) return JNI_FALSE;
+
+    std::vector<Mat> inputs = sentences_to_mats(env, sentences);
+
+    jclass listener_class = env->GetObjectClass(listener);
+    jmethodID on_chunk = env->GetMethodID(listener_class, "onChunk",
+                                          "(Ljava/nio/ByteBuffer;I)Ljava/nio/ByteBuffer;");
+    if (on_chunk == nullptr) return JNI_FALSE;
+
+    LOGD("threads = %d", num_threads);
+    auto start = get_current_time();
+    bool first_chunk = true;
+    // the caller's buffer first, then whichever the listener hands back (local refs of ours)
+    jobject current = buffer;
+    auto callback = [&](const Mat &audio) -> bool {
+        if (first_chunk) {
+            LOGI("first audio after: %f ms", get_current_time() - start);
+            first_chunk = false;
+        }
+        const float *samples = audio;
+        size_t left = size_t(audio.w) * audio.h;
+        while (left > 0) {
+            auto *data = (float *) env->GetDirectBufferAddress(current);
+            jlong capacity = env->GetDirectBufferCapacity(current) / jlong(sizeof(float));
+            if (data == nullptr || capacity <= 0) {
+                LOGE("audio buffer is not a direct buffer");
+                return false;
+            }
+            size_t count = std::min(left, size_t(capacity));
+            memcpy(data, samples, count * sizeof(float));
+            jobject next = env->CallObjectMethod(listener, on_chunk, current, jint(count));
+            if (current != buffer) env->DeleteLocalRef(current);
+            current = next;
+            if (env->ExceptionCheck() || current == nullptr) return false;
+            samples += count;
+            left -= count;
+        }
+        return true;
+    };
+    bool ret = engine->forward_sentences(inputs, callback, num_threads, vulkan, sid, noise_scale,
+                                         noise_scale_w, length_scale, seed, chunk_frames);
+    auto end = get_current_time();
+    LOGI("time cost: %f ms", end - start);
+    if (current != nullptr && current != buffer) env->DeleteLocalRef(current);
+    env->DeleteLocalRef(listener_class);
+    if (ret) return JNI_TRUE;
+    throw_load_error(env, engine);
+    return JNI_FALSE;
+}
+
+static jfloatArray engine_voice_convert(JNIEnv *env, SynthesisEngine *engine, jfloatArray audio,
+                                        jint raw_sid, jint target_sid, jboolean vulkan,
+                                        jint num_threads, jlong seed) {
+    if (engine == nullptr) return {};
 
     // audio to ncnn mat
     float *audio_ = env->GetFloatArrayElements(audio, nullptr);
     jsize audio_size = env->GetArrayLength(audio);
     Mat audio_mat(audio_size, 1);
-    for (int i = 0; i < audio_mat.c; i++) {
-        float *p = audio_mat.channel(i);
-        for (int j = 0; j < audio_size; j++) {
-            p[j] = audio_[j];
-        }
-    }
+    memcpy(audio_mat, audio_, audio_size * sizeof(float));
+    env->ReleaseFloatArrayElements(audio, audio_, JNI_ABORT);
 
     // voice conversion
     if (vulkan) LOGI("vulkan on");
     else
         LOGI("vulkan off");
 
-    opt.num_threads = num_threads;
-    LOGD("threads = %d", opt.num_threads);
+    LOGD("threads = %d", num_threads);
     auto start = get_current_time();
-    auto output = net_g->voice_convert(audio_mat, raw_sid, target_sid, opt,
-                                                vulkan);
+    auto output = engine->voice_convert(audio_mat, raw_sid, target_sid, num_threads, vulkan,
+                                        seed);
+    if (output.empty()) {
+        throw_load_error(env, engine);
+        return {};
+    }
     auto end = get_current_time();
     LOGI("time cost: %f ms", end - start);
     jfloatArray res = env->NewFloatArray(output.h * output.w);
@@ -184,20 +480,266 @@ Java_com_chatwaifu_vits_Vits_voice_1convert(JNIEnv *env, jobject thiz, jfloatArr
     return res;
 }
 
+JNIEXPORT jfloatArray JNICALL
+Java_com_chatwaifu_vits_Vits_forward(JNIEnv *env, jobject thiz, jintArray x, jboolean vulkan,
+                                      jboolean multi, jint sid,
+                                      jfloat noise_scale,
+                                      jfloat noise_scale_w,
+                                      jfloat length_scale,
+                                      jint num_threads,
+                                      jlong seed) {
+    auto engine = default_engine();
+    return engine_forward(env, engine.get(), x, vulkan, sid, noise_scale, noise_scale_w,
+                          length_scale, num_threads, seed);
+}
+
+JNIEXPORT jfloatArray JNICALL
+Java_com_chatwaifu_vits_Vits_engine_1forward(JNIEnv *env, jobject thiz, jlong handle,
+                                             jintArray x, jboolean vulkan, jint sid,
+                                             jfloat noise_scale,
+                                             jfloat noise_scale_w,
+                                             jfloat length_scale,
+                                             jint num_threads,
+                                             jlong seed) {
+    auto engine = find_engine(handle);
+    return engine_forward(env, engine.get(), x, vulkan, sid, noise_scale, noise_scale_w,
+                          length_scale, num_threads, seed);
+}
+
+// synthesizes every sentence and writes them one after another, behind a wav header, into one
+// native buffer that is returned as a direct ByteBuffer: each sample is copied once, from the
+// decoder output into it. The buffer must be handed back to release_buffer
+JNIEXPORT jobject JNICALL
+Java_com_chatwaifu_vits_Vits_forward_1wave(JNIEnv *env, jobject thiz, jobjectArray sentences,
+                                           jboolean vulkan, jint sid,
+                                           jfloat noise_scale,
+                                           jfloat noise_scale_w,
+                                           jfloat length_scale,
+                                           jint num_threads,
+                                           jlong seed,
+                                           jint sampling_rate) {
+    auto engine = default_engine();
+    if (engine == nullptr) return nullptr;
+
+    std::vector<Mat> inputs = sentences_to_mats(env, sentences);
+
+    LOGD("threads = %d", num_threads);
+    auto start = get_current_time();
+    std::vector<Mat> outputs;
+    size_t length = 0;
+    for (const Mat &x: inputs) {
+        Mat output = engine->forward(x, num_threads, vulkan, sid, noise_scale, noise_scale_w,
+                                     length_scale, seed);
+        if (output.empty()) {
+            throw_load_error(env, engine.get());
+            return nullptr;
+        }
+        length += size_t(output.w) * output.h;
+        outputs.push_back(output);
+    }
+    auto end = get_current_time();
+    LOGI("time cost: %f ms", end - start);
+
+    size_t size = WAV_HEADER_SIZE + length * sizeof(float);
+    auto *wave = (char *) malloc(size);
+    if (wave == nullptr) return nullptr;
+    WriteWavHeader(wave, length, sampling_rate);
+    char *samples = wave + WAV_HEADER_SIZE;
+    for (const Mat &output: outputs) {
+        size_t bytes = size_t(output.w) * output.h * sizeof(float);
+        memcpy(samples, (const float *) output, bytes);
+        samples += bytes;
+    }
+    jobject buffer = env->NewDirectByteBuffer(wave, (jlong) size);
+    if (buffer == nullptr) free(wave);
+    return buffer;
+}
+
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_Vits_release_1buffer(JNIEnv *env, jobject thiz, jobject buffer) {
+    if (buffer == nullptr) return;
+    free(env->GetDirectBufferAddress(buffer));
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_chatwaifu_vits_Vits_forward_1stream(JNIEnv *env, jobject thiz, jintArray x,
+                                             jboolean vulkan, jboolean multi, jint sid,
+                                             jfloat noise_scale,
+                                             jfloat noise_scale_w,
+                                             jfloat length_scale,
+                                             jint num_threads,
+                                             jint chunk_frames,
+                                             jlong seed,
+                                             jobject listener) {
+    auto engine = default_engine();
+    return engine_forward_stream(env, engine.get(), x, vulkan, sid, noise_scale, noise_scale_w,
+                                 length_scale, num_threads, chunk_frames, seed, listener);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_chatwaifu_vits_Vits_engine_1forward_1stream(JNIEnv *env, jobject thiz, jlong handle,
+                                                    jintArray x, jboolean vulkan, jint sid,
+                                                    jfloat noise_scale,
+                                                    jfloat noise_scale_w,
+                                                    jfloat length_scale,
+                                                    jint num_threads,
+                                                    jint chunk_frames,
+                                                    jlong seed,
+                                                    jobject listener) {
+    auto engine = find_engine(handle);
+    return engine_forward_stream(env, engine.get(), x, vulkan, sid, noise_scale, noise_scale_w,
+                                 length_scale, num_threads, chunk_frames, seed, listener);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_chatwaifu_vits_Vits_forward_1sentences(JNIEnv *env, jobject thiz,
+                                                jobjectArray sentences,
+                                                jboolean vulkan, jint sid,
+                                                jfloat noise_scale,
+                                                jfloat noise_scale_w,
+                                                jfloat length_scale,
+                                                jint num_threads,
+                                                jint chunk_frames,
+                                                jlong seed,
+                                                jobject listener) {
+    auto engine = default_engine();
+    return engine_forward_sentences(env, engine.get(), sentences, vulkan, sid, noise_scale,
+                                    noise_scale_w, length_scale, num_threads, chunk_frames, seed,
+                                    listener);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_chatwaifu_vits_Vits_engine_1forward_1sentences(JNIEnv *env, jobject thiz, jlong handle,
+                                                       jobjectArray sentences,
+                                                       jboolean vulkan, jint sid,
+                                                       jfloat noise_scale,
+                                                       jfloat noise_scale_w,
+                                                       jfloat length_scale,
+                                                       jint num_threads,
+                                                       jint chunk_frames,
+                                                       jlong seed,
+                                                       jobject listener) {
+    auto engine = find_engine(handle);
+    return engine_forward_sentences(env, engine.get(), sentences, vulkan, sid, noise_scale,
+                                    noise_scale_w, length_scale, num_threads, chunk_frames, seed,
+                                    listener);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_chatwaifu_vits_Vits_forward_1sentences_1into(JNIEnv *env, jobject thiz,
+                                                      jobjectArray sentences,
+                                                      jboolean vulkan, jint sid,
+                                                      jfloat noise_scale,
+                                                      jfloat noise_scale_w,
+                                                      jfloat length_scale,
+                                                      jint num_threads,
+                                                      jint chunk_frames,
+                                                      jlong seed,
+                                                      jobject buffer,
+                                                      jobject listener) {
+    auto engine = default_engine();
+    return engine_forward_sentences_into(env, engine.get(), sentences, vulkan, sid, noise_scale,
+                                         noise_scale_w, length_scale, num_threads, chunk_frames,
+                                         seed, buffer, listener);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_chatwaifu_vits_Vits_engine_1forward_1sentences_1into(JNIEnv *env, jobject thiz,
+                                                              jlong handle,
+                                                              jobjectArray sentences,
+                                                              jboolean vulkan, jint sid,
+                                                              jfloat noise_scale,
+                                                              jfloat noise_scale_w,
+                                                              jfloat length_scale,
+                                                              jint num_threads,
+                                                              jint chunk_frames,
+                                                              jlong seed,
+                                                              jobject buffer,
+                                                              jobject listener) {
+    auto engine = find_engine(handle);
+    return engine_forward_sentences_into(env, engine.get(), sentences, vulkan, sid, noise_scale,
+                                         noise_scale_w, length_scale, num_threads, chunk_frames,
+                                         seed, buffer, listener);
+}
+
+JNIEXPORT jfloatArray JNICALL
+Java_com_chatwaifu_vits_Vits_voice_1convert(JNIEnv *env, jobject thiz, jfloatArray audio,
+                                             jint raw_sid, jint target_sid, jboolean vulkan,
+                                             jint num_threads, jlong seed) {
+    auto engine = default_engine();
+    return engine_voice_convert(env, engine.get(), audio, raw_sid, target_sid, vulkan,
+                                num_threads, seed);
+}
+
+JNIEXPORT jfloatArray JNICALL
+Java_com_chatwaifu_vits_Vits_engine_1voice_1convert(JNIEnv *env, jobject thiz, jlong handle,
+                                                    jfloatArray audio, jint raw_sid,
+                                                    jint target_sid, jboolean vulkan,
+                                                    jint num_threads, jlong seed) {
+    auto engine = find_engine(handle);
+    return engine_voice_convert(env, engine.get(), audio, raw_sid, target_sid, vulkan,
+                                num_threads, seed);
+}
+
+static void engine_configure_cache(JNIEnv *env, SynthesisEngine *engine, jlong budget_bytes,
+                                   jstring spill_folder, jlong spill_budget_bytes) {
+    if (engine == nullptr) return;
+    std::string folder;
+    if (spill_folder != nullptr) {
+        const char *_folder = env->GetStringUTFChars(spill_folder, nullptr);
+        folder = _folder;
+        env->ReleaseStringUTFChars(spill_folder, _folder);
+    }
+    engine->configure_cache(size_t(std::max<jlong>(budget_bytes, 0)), folder,
+                            size_t(std::max<jlong>(spill_budget_bytes, 0)));
+}
+
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_Vits_configure_1cache(JNIEnv *env, jobject thiz, jlong budget_bytes,
+                                              jstring spill_folder, jlong spill_budget_bytes) {
+    auto engine = default_engine();
+    engine_configure_cache(env, engine.get(), budget_bytes, spill_folder, spill_budget_bytes);
+}
+
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_Vits_engine_1configure_1cache(JNIEnv *env, jobject thiz, jlong handle,
+                                                     jlong budget_bytes, jstring spill_folder,
+                                                     jlong spill_budget_bytes) {
+    auto engine = find_engine(handle);
+    engine_configure_cache(env, engine.get(), budget_bytes, spill_folder, spill_budget_bytes);
+}
+
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_Vits_trim(JNIEnv *env, jobject thiz) {
+    auto engine = default_engine();
+    if (engine != nullptr) engine->trim();
+}
+
+JNIEXPORT void JNICALL
+Java_com_chatwaifu_vits_Vits_engine_1trim(JNIEnv *env, jobject thiz, jlong handle) {
+    auto engine = find_engine(handle);
+    if (engine != nullptr) engine->trim();
+}
+
 // wave utils
 JNIEXPORT jbyteArray JNICALL
 Java_com_chatwaifu_vits_utils_audio_WaveUtils_convertAudioPCMToWaveByteArray(JNIEnv *env,
                                       jobject thiz,
                                       jfloatArray jaudio,
                                       jint sampling_rate) {
-    float *audio = env->GetFloatArrayElements(jaudio, nullptr);
     jsize audio_size = env->GetArrayLength(jaudio);
-    // convert audio
-    auto wave = PCMToWavFormat(audio, audio_size, sampling_rate);
-    if (wave == nullptr) return nullptr;
-    auto size = static_cast<jsize>(audio_size * 4 + 44);
+    if (audio_size == 0) return nullptr;
+    auto size = static_cast<jsize>(audio_size * sizeof(float) + WAV_HEADER_SIZE);
     jbyteArray out = env->NewByteArray(size);
-    env->SetByteArrayRegion(out, 0, size, reinterpret_cast<const jbyte *>(wave));
+    if (out == nullptr) return nullptr;
+    // header and samples go straight into the java array
+    char header[WAV_HEADER_SIZE];
+    WriteWavHeader(header, audio_size, sampling_rate);
+    env->SetByteArrayRegion(out, 0, WAV_HEADER_SIZE, reinterpret_cast<const jbyte *>(header));
+    float *audio = env->GetFloatArrayElements(jaudio, nullptr);
+    env->SetByteArrayRegion(out, WAV_HEADER_SIZE, size - WAV_HEADER_SIZE,
+                            reinterpret_cast<const jbyte *>(audio));
+    env->ReleaseFloatArrayElements(jaudio, audio, JNI_ABORT);
     return out;
 }
 }
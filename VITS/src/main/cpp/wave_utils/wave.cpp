@@ -4,17 +4,14 @@
 
 #include "wave.h"
 
-char* PCMToWavFormat(float* audio, size_t length, int sampling_rate) {
-    if (length == 0) return {};
-
+void WriteWavHeader(char* header, size_t length, int sampling_rate) {
     size_t audioLen = length * 4;
     size_t dataLen = audioLen + 36;
     int channels = 1;
     int sample_bit = sizeof(float) * 8;
-    long bit_rate = sampling_rate * channels * 16 / 8;
+    long bit_rate = sampling_rate * channels * sample_bit / 8;
 
-    //std::vector<char> wave;
-    char* wave = new char[dataLen + 8];
+    char* wave = header;
 
     // add wave head
     // RIFF/WAVE header
@@ -83,8 +80,15 @@ char* PCMToWavFormat(float* audio, size_t length, int sampling_rate) {
     wave[41] = (char)((audioLen >> 8) & 0xff);
     wave[42] = (char)((audioLen >> 16) & 0xff);
     wave[43] = (char)((audioLen >> 24) & 0xff);
+}
+
+char* PCMToWavFormat(float* audio, size_t length, int sampling_rate) {
+    if (length == 0) return {};
+
+    char* wave = new char[WAV_HEADER_SIZE + length * 4];
+    WriteWavHeader(wave, length, sampling_rate);
 
     // add wave data
-    memcpy(wave + 44, audio, audioLen);
+    memcpy(wave + WAV_HEADER_SIZE, audio, length * 4);
     return wave;
 }
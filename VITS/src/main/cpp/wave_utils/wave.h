@@ -2,10 +2,18 @@
 #define MOERENG_WAVE_H
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 
-// convert pcm audio to wav format
+// size of the RIFF header in front of the samples
+#define WAV_HEADER_SIZE 44
+
+// write the header of mono 32 bit float pcm with length samples to the first WAV_HEADER_SIZE bytes
+// of header, the samples are expected right after it
+void WriteWavHeader(char* header, size_t length, int sampling_rate);
+
+// convert pcm audio to wav format, the result is allocated with new[] and owned by the caller
 char* PCMToWavFormat(float* audio, size_t length, int sampling_rate);
 
 #endif //MOERENG_WAVE_H
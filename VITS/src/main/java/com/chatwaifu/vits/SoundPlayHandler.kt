@@ -7,6 +7,10 @@ import android.os.Handler
 import android.os.HandlerThread
 import android.os.Message
 import android.util.Log
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+import java.util.concurrent.ArrayBlockingQueue
+import java.util.concurrent.TimeUnit
 
 /**
  * Description: SoundPlayHandler
@@ -21,7 +25,14 @@ class SoundPlayHandler {
     private var audioFormat = AudioFormat.ENCODING_PCM_FLOAT
     private var bufferSize = 0
 
+    // direct buffers synthesis writes into, each goes back here once AudioTrack has played it.
+    // Together they bound how far synthesis may run ahead of playback
+    private val freeBuffers = ArrayBlockingQueue<ByteBuffer>(BUFFER_COUNT)
+
     init {
+        repeat(BUFFER_COUNT) {
+            freeBuffers.add(ByteBuffer.allocateDirect(BUFFER_BYTES).order(ByteOrder.nativeOrder()))
+        }
         val handlerThread = HandlerThread("SoundPlayHandler")
         handlerThread.start()
         handler = object : Handler(handlerThread.looper) {
@@ -58,10 +69,36 @@ class SoundPlayHandler {
     }
 
     fun sendSound(floatArray: FloatArray) {
-        handler.sendMessage(Message.obtain(handler, 0, floatArray))
+        handler.sendMessage(Message.obtain(handler, MSG_ARRAY, floatArray))
+    }
+
+    // a free buffer to synthesize into, waits while all of them are queued for playback and gives
+    // null if none came back in time
+    fun obtainBuffer(): ByteBuffer? = freeBuffers.poll(BUFFER_WAIT_SECONDS, TimeUnit.SECONDS)
+
+    // plays the bytes between position and limit of a buffer from obtainBuffer, which is free
+    // again afterwards
+    fun sendSound(buffer: ByteBuffer) {
+        handler.sendMessage(Message.obtain(handler, MSG_BUFFER, buffer))
+    }
+
+    // hands back a buffer from obtainBuffer that was not filled
+    fun recycleBuffer(buffer: ByteBuffer) {
+        freeBuffers.offer(buffer)
     }
 
     fun onHandleMessage(msg: Message) {
+        if (msg.what == MSG_BUFFER) {
+            val buffer = msg.obj as ByteBuffer
+            try {
+                audioTrack?.write(buffer, buffer.remaining(), AudioTrack.WRITE_BLOCKING)
+            } catch (e: Exception) {
+                e.printStackTrace()
+            } finally {
+                freeBuffers.offer(buffer)
+            }
+            return
+        }
         val sound = msg.obj as FloatArray
         try {
             Log.d(TAG, "try to write arr....")
@@ -76,5 +113,11 @@ class SoundPlayHandler {
     }
     companion object {
         private const val TAG = "SoundPlayHandler"
+        private const val MSG_ARRAY = 0
+        private const val MSG_BUFFER = 1
+        // one stream chunk (64 frames of 256 samples) per buffer, about 6 s of audio in all
+        private const val BUFFER_BYTES = 64 * 256 * 4
+        private const val BUFFER_COUNT = 8
+        private const val BUFFER_WAIT_SECONDS = 5L
     }
 }
\ No newline at end of file
@@ -1,10 +1,33 @@
 package com.chatwaifu.vits
 
 import android.content.res.AssetManager
+import java.nio.ByteBuffer
 
 object Vits {
+    // pass as seed to get fresh noise on every call, any other value >= 0 makes the output repeatable
+    const val RANDOM_SEED = -1L
+
+    // weight files create_engine loads, the smaller ones are written by tools/vits_quantize
+    const val WEIGHTS_FP32 = 0
+    const val WEIGHTS_FP16 = 1
+    const val WEIGHTS_INT8 = 2
+
+    // receives streamed audio blocks in playback order, return false to stop synthesis
+    fun interface AudioChunkListener {
+        fun onChunk(chunk: FloatArray): Boolean
+    }
+
+    // receives streamed audio written into a direct buffer: samples native order floats from its
+    // start. Returns the direct buffer the next block is written into, null to stop synthesis
+    fun interface AudioBufferListener {
+        fun onChunk(buffer: ByteBuffer, samples: Int): ByteBuffer?
+    }
+
     external fun init_vits(assetManager: AssetManager, path: String, voice_convert: Boolean, multi: Boolean, n_vocab: Int): Boolean
 
+    // init_vits / create_engine parse every net of the model and fail on a broken one, the weights
+    // load on first use: forward, voice_convert and the streaming calls throw
+    // IllegalStateException when that load fails instead of returning no audio
     external fun forward(
         x: IntArray,
         vulkan: Boolean,
@@ -13,13 +36,155 @@ object Vits {
         noise_scale: Float,
         noise_scale_w: Float,
         length_scale: Float,
-        num_threads: Int
+        num_threads: Int,
+        seed: Long
     ): FloatArray?
 
+    // synthesizes the sentences into one native direct buffer: a 44 byte wav header followed by
+    // their little endian float pcm, one after another. Hand it back to release_buffer when done
+    external fun forward_wave(
+        x: Array<IntArray>,
+        vulkan: Boolean,
+        sid: Int,
+        noise_scale: Float,
+        noise_scale_w: Float,
+        length_scale: Float,
+        num_threads: Int,
+        seed: Long,
+        sampling_rate: Int
+    ): ByteBuffer?
+
+    external fun release_buffer(buffer: ByteBuffer)
+
+    external fun forward_stream(
+        x: IntArray,
+        vulkan: Boolean,
+        multi: Boolean,
+        sid: Int,
+        noise_scale: Float,
+        noise_scale_w: Float,
+        length_scale: Float,
+        num_threads: Int,
+        chunk_frames: Int,
+        seed: Long,
+        listener: AudioChunkListener
+    ): Boolean
+
+    // streams several sentences in order, the encoder of the next sentence overlaps the decoder of
+    // the current one. Chunks arrive on the calling thread
+    external fun forward_sentences(
+        x: Array<IntArray>,
+        vulkan: Boolean,
+        sid: Int,
+        noise_scale: Float,
+        noise_scale_w: Float,
+        length_scale: Float,
+        num_threads: Int,
+        chunk_frames: Int,
+        seed: Long,
+        listener: AudioChunkListener
+    ): Boolean
+
+    // forward_sentences without a FloatArray per block: every block is written into buffer, then
+    // into the buffers the listener hands back
+    external fun forward_sentences_into(
+        x: Array<IntArray>,
+        vulkan: Boolean,
+        sid: Int,
+        noise_scale: Float,
+        noise_scale_w: Float,
+        length_scale: Float,
+        num_threads: Int,
+        chunk_frames: Int,
+        seed: Long,
+        buffer: ByteBuffer,
+        listener: AudioBufferListener
+    ): Boolean
+
     external fun voice_convert(
         audio: FloatArray, raw_sid: Int, target_sid: Int,
-        vulkan: Boolean, num_threads: Int
-    ): FloatArray
+        vulkan: Boolean, num_threads: Int, seed: Long
+    ): FloatArray?
+
+    // independent engines, one per loaded model: handles from create_engine (0 on failure) may be
+    // used from several threads at once and must be freed with destroy_engine. weight_format is
+    // one of the WEIGHTS_* constants, nets without a file of that format load the fp32 one
+    external fun create_engine(assetManager: AssetManager, path: String, voice_convert: Boolean, multi: Boolean, n_vocab: Int, weight_format: Int): Long
+
+    external fun destroy_engine(handle: Long)
+
+    external fun engine_forward(
+        handle: Long,
+        x: IntArray,
+        vulkan: Boolean,
+        sid: Int,
+        noise_scale: Float,
+        noise_scale_w: Float,
+        length_scale: Float,
+        num_threads: Int,
+        seed: Long
+    ): FloatArray?
+
+    external fun engine_forward_stream(
+        handle: Long,
+        x: IntArray,
+        vulkan: Boolean,
+        sid: Int,
+        noise_scale: Float,
+        noise_scale_w: Float,
+        length_scale: Float,
+        num_threads: Int,
+        chunk_frames: Int,
+        seed: Long,
+        listener: AudioChunkListener
+    ): Boolean
+
+    external fun engine_forward_sentences(
+        handle: Long,
+        x: Array<IntArray>,
+        vulkan: Boolean,
+        sid: Int,
+        noise_scale: Float,
+        noise_scale_w: Float,
+        length_scale: Float,
+        num_threads: Int,
+        chunk_frames: Int,
+        seed: Long,
+        listener: AudioChunkListener
+    ): Boolean
+
+    external fun engine_forward_sentences_into(
+        handle: Long,
+        x: Array<IntArray>,
+        vulkan: Boolean,
+        sid: Int,
+        noise_scale: Float,
+        noise_scale_w: Float,
+        length_scale: Float,
+        num_threads: Int,
+        chunk_frames: Int,
+        seed: Long,
+        buffer: ByteBuffer,
+        listener: AudioBufferListener
+    ): Boolean
+
+    external fun engine_voice_convert(
+        handle: Long, audio: FloatArray, raw_sid: Int, target_sid: Int,
+        vulkan: Boolean, num_threads: Int, seed: Long
+    ): FloatArray?
+
+    // audio of requests with a fixed seed is kept in memory up to budget_bytes and replayed when
+    // the same tokens and parameters come again, evicted entries move to spill_folder (null for
+    // none) up to spill_budget_bytes
+    external fun configure_cache(budget_bytes: Long, spill_folder: String?, spill_budget_bytes: Long)
+
+    external fun engine_configure_cache(handle: Long, budget_bytes: Long, spill_folder: String?, spill_budget_bytes: Long)
+
+    // gives back the pooled request memory and the in-memory audio cache, the model stays loaded.
+    // Call when synthesis goes idle or the system is low on memory
+    external fun trim()
+
+    external fun engine_trim(handle: Long)
 
     init {
         System.loadLibrary("moereng")
@@ -10,6 +10,10 @@ import com.chatwaifu.vits.utils.file.FileUtils
 import com.chatwaifu.vits.utils.text.ChineseTextUtils
 import com.chatwaifu.vits.utils.text.JapaneseTextUtils
 import com.chatwaifu.vits.utils.text.TextUtils
+import java.io.File
+import java.io.FileOutputStream
+import java.nio.ByteBuffer
+import java.nio.FloatBuffer
 
 /**
  * Description: SoundGenerateHelper
@@ -19,6 +23,9 @@ import com.chatwaifu.vits.utils.text.TextUtils
 class SoundGenerateHelper(val context: Context) {
     companion object {
         private const val TAG = "SoundGenerateHelper"
+        private const val STREAM_CHUNK_FRAMES = 64
+        private const val CACHE_BYTES = 16L shl 20
+        private const val CACHE_SPILL_BYTES = 64L shl 20
     }
 
     private var textUtils: TextUtils? = null
@@ -31,6 +38,10 @@ class SoundGenerateHelper(val context: Context) {
     private var noiseScaleW: Float = .9f
     private var lengthScale: Float = 1f
     private var sid = 0
+
+    // noise seed of every synthesis, Vits.RANDOM_SEED for a new one each time. With a fixed seed
+    // repeated lines are replayed from the synthesis cache
+    var seed: Long = Vits.RANDOM_SEED
     private var modelInitState: Boolean = false
     private var voiceConvert = false
     private var targetFolder: String = ""
@@ -67,7 +78,10 @@ class SoundGenerateHelper(val context: Context) {
                     textUtils = ChineseTextUtils(symbols, cleanerName, context.assets)
                 }
                 cleanerName.contains("japanese") -> {
-                    textUtils = JapaneseTextUtils(symbols, cleanerName, context.assets)
+                    textUtils = JapaneseTextUtils(
+                        symbols, cleanerName, context.assets,
+                        java.io.File(context.filesDir, "openjtalk_labels.cache").absolutePath
+                    )
                 }
             }
 
@@ -117,6 +131,11 @@ class SoundGenerateHelper(val context: Context) {
             n_vocab
         )
         Log.d(TAG, "model init status $modelInitState")
+        if (modelInitState) {
+            val spillFolder = java.io.File(context.cacheDir, "vits_pcm")
+            spillFolder.mkdirs()
+            Vits.configure_cache(CACHE_BYTES, spillFolder.absolutePath, CACHE_SPILL_BYTES)
+        }
 
         callback.invoke(modelInitState)
     }
@@ -127,7 +146,7 @@ class SoundGenerateHelper(val context: Context) {
         text: String?,
         targetSpeakerId: Int = 0,
         callback: (isSuccess: Boolean) -> Unit,
-        forwardResult: (FloatArray) -> Unit
+        forwardResult: (FloatBuffer) -> Unit
     ) {
         text ?: return callback.invoke(false)
         try {
@@ -135,22 +154,35 @@ class SoundGenerateHelper(val context: Context) {
             val inputs = textUtils?.convertText(text)
             if (inputs != null && inputs.isNotEmpty()) {
 
-                // inference for each sentence
-                for (i in inputs.indices) {
-                    // start inference
-                    Vits.forward(
-                        inputs[i],
+                // all sentences in one call, the next one is encoded while the current one
+                // decodes and its audio is played as it arrives. Blocks are written straight into
+                // the player's direct buffers, the next one comes back as this one is queued
+                val first = soundHandler.obtainBuffer() ?: return callback.invoke(false)
+                // the buffer synthesis holds but has not filled, returned to the player at the end
+                var pending: ByteBuffer? = first
+                try {
+                    Vits.forward_sentences_into(
+                        inputs.toTypedArray(),
                         vulkan = false,
-                        multi,
                         targetSpeakerId,
                         noiseScale,
                         noiseScaleW,
                         lengthScale,
-                        currentThreadCount
-                    )?.let {
-                        soundHandler.sendSound(it)
-                        forwardResult(it)
+                        currentThreadCount,
+                        STREAM_CHUNK_FRAMES,
+                        seed,
+                        first
+                    ) { buffer, samples ->
+                        buffer.clear()
+                        buffer.limit(samples * Float.SIZE_BYTES)
+                        // only valid until the buffer is played
+                        forwardResult(buffer.asFloatBuffer().asReadOnlyBuffer())
+                        pending = null
+                        soundHandler.sendSound(buffer)
+                        soundHandler.obtainBuffer().also { pending = it }
                     }
+                } finally {
+                    pending?.let { soundHandler.recycleBuffer(it) }
                 }
                 return callback.invoke(true)
             }
@@ -161,7 +193,43 @@ class SoundGenerateHelper(val context: Context) {
         }
     }
 
+    // synthesizes text and writes it to file as a wav of float samples, the audio goes from one
+    // native buffer to the file without passing through the java heap
+    fun saveWave(text: String?, file: File, targetSpeakerId: Int = 0): Boolean {
+        text ?: return false
+        if (!modelInitState) return false
+        return try {
+            val inputs = textUtils?.convertText(text)
+            if (inputs.isNullOrEmpty()) return false
+            val wave = Vits.forward_wave(
+                inputs.toTypedArray(),
+                vulkan = false,
+                targetSpeakerId,
+                noiseScale,
+                noiseScaleW,
+                lengthScale,
+                currentThreadCount,
+                seed,
+                samplingRate
+            ) ?: return false
+            try {
+                FileOutputStream(file).channel.use { channel ->
+                    while (wave.hasRemaining()) channel.write(wave)
+                }
+            } finally {
+                Vits.release_buffer(wave)
+            }
+            true
+        } catch (e: Exception) {
+            e.printStackTrace()
+            Log.e(TAG, e.message.toString())
+            false
+        }
+    }
+
     fun clear() {
+        (textUtils as? JapaneseTextUtils)?.saveLabelCache()
+        Vits.trim()
         soundHandler.release()
         modelInitState = false
         config = null
@@ -6,9 +6,16 @@ import android.util.Log
 class JapaneseTextUtils(
     override val symbols: List<String>,
     override val cleanerName: String,
-    override val assetManager: AssetManager
+    override val assetManager: AssetManager,
+    // where the openjtalk label cache persists between runs, null to keep it in memory only
+    private val labelCacheFile: String? = null
 ) : TextUtils {
+    companion object {
+        private const val LABEL_CACHE_BYTES = 4L shl 20
+    }
+
     private var openJtalkInitialized = false
+    private var segmenter = 0L
 
     private fun initDictionary(assetManager: AssetManager) {
         // init openjatlk
@@ -18,6 +25,7 @@ class JapaneseTextUtils(
                 throw RuntimeException("初始化openjtalk字典失败！")
             }
             Log.i("TextUtils", "Openjtalk字典初始化成功！")
+            configureLabelCache(LABEL_CACHE_BYTES, labelCacheFile)
         }
     }
 
@@ -113,10 +121,54 @@ class JapaneseTextUtils(
         return convertSentenceToLabels(cleanedInputs)
     }
 
+    // streamed input such as a reply that arrives in pieces: returns the labels of every sentence
+    // completed by this piece, so synthesis can start on the first one. last = true ends the
+    // stream and converts whatever is left
+    fun convertTextStream(text: String, last: Boolean): List<IntArray> {
+        initDictionary(assetManager)
+        if (segmenter == 0L) {
+            segmenter = createSegmenter(100)
+        }
+        val outputs = ArrayList<IntArray>()
+        segmenterPush(segmenter, text)
+        while (true) {
+            val sentence = segmenterNext(segmenter, last) ?: break
+            outputs.addAll(convertSentenceToLabels(cleanInputs(sentence)))
+        }
+        if (last) {
+            destroySegmenter(segmenter)
+            segmenter = 0L
+        }
+        return outputs
+    }
+
+    // writes the label cache to labelCacheFile so the next run starts warm
+    fun saveLabelCache(): Boolean {
+        if (!openJtalkInitialized || labelCacheFile == null) return false
+        val stats = labelCacheStats()
+        Log.i("TextUtils", "label cache hits ${stats[0]} misses ${stats[1]}")
+        return saveLabelCache(labelCacheFile)
+    }
+
     external fun initOpenJtalk(assetManager: AssetManager): Boolean
 
     external fun splitSentenceCpp(text: String): String
 
+    private external fun createSegmenter(maxChars: Int): Long
+
+    private external fun destroySegmenter(handle: Long)
+
+    private external fun segmenterPush(handle: Long, text: String)
+
+    private external fun segmenterNext(handle: Long, flush: Boolean): String?
+
+    private external fun configureLabelCache(budgetBytes: Long, file: String?)
+
+    private external fun saveLabelCache(file: String): Boolean
+
+    // hits and misses since start
+    external fun labelCacheStats(): LongArray
+
     init {
         System.loadLibrary("moereng")
     }
@@ -12,6 +12,7 @@ import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.Job
 import kotlinx.coroutines.delay
 import kotlinx.coroutines.launch
+import java.nio.FloatBuffer
 
 
 /**
@@ -82,20 +83,20 @@ class LipsValueHandler() {
     }
 
     private fun onHandleMessage(msg: Message) {
-        val data = msg.obj as FloatArray
         if (!USE_REAL_LIP_SYNC) {
-            playDefaultAnimation(data)
+            playDefaultAnimation(msg.arg1)
             return
         }
+        val data = msg.obj as FloatArray
         val result = LipSyncJNI.ovrLipSync_ProcessFrame(SAMPLE_SIZE, data, data.size).toList()
         //this is total result
         Log.d(TAG, "$result")
         JniBridgeJava.nativeProjectMouthOpenY(0f)
     }
 
-    private fun playDefaultAnimation(data: FloatArray) {
+    private fun playDefaultAnimation(samples: Int) {
         //根据 data 长度粗略估计一下动画时长...
-        val time = data.size.toLong() * 1000 / SAMPLE_SIZE
+        val time = samples.toLong() * 1000 / SAMPLE_SIZE
         Log.d(TAG, "try to play animation in $time")
         animationJob?.cancel()
         animationJob = CoroutineScope(Dispatchers.Main.immediate).launch {
@@ -117,8 +118,12 @@ class LipsValueHandler() {
         animationTimer?.start()
     }
 
-    fun sendLipsValues(array: FloatArray) {
-        handler.sendMessage(Message.obtain(handler, 0, array))
+    // samples is only valid during the call, the default animation needs just its length and
+    // real lip sync gets a copy
+    fun sendLipsValues(samples: FloatBuffer) {
+        val size = samples.remaining()
+        val data = if (USE_REAL_LIP_SYNC) FloatArray(size).also { samples.get(it) } else null
+        handler.sendMessage(Message.obtain(handler, 0, size, 0, data))
     }
 
     fun destroyContext() {